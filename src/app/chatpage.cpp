@@ -32,6 +32,8 @@
 #include "treewidget.h"
 #include "themeloader.h"
 #include "textdocument.h"
+#include "messagestore.h"
+#include "messagelog.h"
 #include "pluginloader.h"
 #include "textbrowser.h"
 #include "bufferview.h"
@@ -44,6 +46,7 @@
 #include "mainwindow.h"
 #include "scrollbarstyle.h"
 #include "messagehandler.h"
+#include "flushscheduler.h"
 #include <QCoreApplication>
 #include <IrcCommandParser>
 #include <IrcBufferModel>
@@ -54,6 +57,7 @@
 #include <IrcChannel>
 #include <IrcBuffer>
 #include <QSettings>
+#include <QTimer>
 #include <Irc>
 
 ChatPage::ChatPage(QWidget* parent) : QSplitter(parent)
@@ -80,6 +84,13 @@ ChatPage::ChatPage(QWidget* parent) : QSplitter(parent)
     connect(d.splitView, SIGNAL(currentBufferChanged(IrcBuffer*)), this, SLOT(onCurrentBufferChanged(IrcBuffer*)));
     connect(d.splitView, SIGNAL(currentViewChanged(BufferView*,BufferView*)), this, SLOT(onCurrentViewChanged(BufferView*,BufferView*)));
 
+    // predictions follow switches, badges and highlights, but
+    // are not worked out again for every single message
+    d.predictor = new QTimer(this);
+    d.predictor->setSingleShot(true);
+    d.predictor->setInterval(500);
+    connect(d.predictor, SIGNAL(timeout()), this, SLOT(updatePredictions()));
+
     setStretchFactor(1, 1);
 
     addView(d.splitView->currentView());
@@ -363,6 +374,13 @@ void ChatPage::addBuffer(IrcBuffer* buffer)
     id += "/" + buffer->title();
     doc->setTimestamp(d.timestamps.value(id).toDateTime());
 
+    MessageStore* store = doc->store();
+    store->setLazy(true);
+    store->setThreaded(true);
+    store->setFirehoseThreshold(QSettings().value("firehose", 100).toInt());
+    if (!store->log())
+        store->setLog(new MessageLog(id, store));
+
     setupDocument(doc);
     PluginLoader::instance()->documentAdded(doc);
 
@@ -442,6 +460,7 @@ void ChatPage::onCurrentBufferChanged(IrcBuffer* buffer)
                 handler->setCurrentBuffer(buffer);
         }
         d.currentBuffer = buffer;
+        d.predictor->start();
     }
 }
 
@@ -468,8 +487,11 @@ void ChatPage::onMessageReceived(IrcMessage* message)
                     }
                 }
                 // exclude broadcasted global notices
-                if (!visible && (message->type() != IrcMessage::Notice || static_cast<IrcNoticeMessage*>(message)->target() != "$$*"))
+                if (!visible && (message->type() != IrcMessage::Notice || static_cast<IrcNoticeMessage*>(message)->target() != "$$*")) {
                     item->setData(1, TreeRole::Badge, item->data(1, TreeRole::Badge).toInt() + 1);
+                    if (!d.predictor->isActive())
+                        d.predictor->start();
+                }
             }
         }
     }
@@ -483,10 +505,29 @@ void ChatPage::onAlert(IrcMessage* message)
         if (doc && !doc->isVisible()) {
             IrcBuffer* buffer = doc->buffer();
             TreeItem* item = d.treeWidget->bufferItem(buffer);
-            if (buffer && item != d.treeWidget->currentItem())
+            if (buffer && item != d.treeWidget->currentItem()) {
                 d.treeWidget->highlightItem(item);
+                if (!d.predictor->isActive())
+                    d.predictor->start();
+            }
+        }
+    }
+}
+
+void ChatPage::updatePredictions()
+{
+    // the documents of the buffers the user is most likely to switch
+    // to next get formatted and laid out while the application is idle
+    QList<TextDocument*> documents;
+    foreach (IrcBuffer* buffer, d.treeWidget->likelyBuffers(8)) {
+        foreach (TextDocument* doc, buffer->findChildren<TextDocument*>()) {
+            if (!doc->isClone()) {
+                documents += doc;
+                break;
+            }
         }
     }
+    FlushScheduler::instance()->setPredicted(documents);
 }
 
 void ChatPage::onSocketError()
@@ -499,8 +540,7 @@ void ChatPage::onSocketError()
             if (buffer) {
                 QStringList params = QStringList() << connection->nickName() << connection->socket()->errorString();
                 IrcMessage* message = IrcMessage::fromParameters(buffer->title(), QString::number(Irc::ERR_UNKNOWNERROR), params, connection);
-                foreach (TextDocument* doc, buffer->findChildren<TextDocument*>())
-                    doc->receiveMessage(message);
+                MessageStore::instance(buffer)->receiveMessage(message);
                 delete message;
 
                 TreeItem* item = d.treeWidget->connectionItem(connection);
@@ -521,8 +561,7 @@ void ChatPage::onSecureError()
             if (buffer) {
                 QStringList params = QStringList() << connection->nickName() << tr("Unable to establish secure connection.");
                 IrcMessage* message = IrcMessage::fromParameters(buffer->title(), QString::number(Irc::ERR_UNKNOWNERROR), params, connection);
-                foreach (TextDocument* doc, buffer->findChildren<TextDocument*>())
-                    doc->receiveMessage(message);
+                MessageStore::instance(buffer)->receiveMessage(message);
                 delete message;
             }
         }
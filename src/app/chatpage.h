@@ -37,6 +37,7 @@
 #include "themeinfo.h"
 
 class Finder;
+class QTimer;
 class IrcBuffer;
 class SplitView;
 class TreeWidget;
@@ -93,6 +94,7 @@ private slots:
     void onCurrentViewChanged(BufferView* current, BufferView* previous);
     void onMessageReceived(IrcMessage* message);
     void onAlert(IrcMessage* message);
+    void updatePredictions();
     void onSocketError();
     void onSecureError();
     void onConnected();
@@ -105,6 +107,7 @@ private:
         ThemeInfo theme;
         QString timestamp;
         QStringList chans;
+        QTimer* predictor;
         SplitView* splitView;
         TreeWidget* treeWidget;
         QVariantMap timestamps;
@@ -65,6 +65,25 @@ void TreeBadge::setNum(int num)
     setText(txt);
 }
 
+QPixmap TreeBadge::pixmap(const QSize& size, qreal ratio)
+{
+    return d.cache.pixmap(this, size, ratio, QString::number(d.hilite) + QLatin1Char(':') + text());
+}
+
+void TreeBadge::changeEvent(QEvent* event)
+{
+    switch (event->type()) {
+    case QEvent::StyleChange:
+    case QEvent::PaletteChange:
+    case QEvent::FontChange:
+        d.cache.clear();
+        break;
+    default:
+        break;
+    }
+    QLabel::changeEvent(event);
+}
+
 void TreeBadge::paintEvent(QPaintEvent* event)
 {
     QPainter painter(this);
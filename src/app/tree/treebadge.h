@@ -30,6 +30,7 @@
 #define TREEBADGE_H
 
 #include <QLabel>
+#include "widgetcache.h"
 
 class TreeBadge : public QLabel
 {
@@ -43,7 +44,10 @@ public:
     void setNum(int num);
     void setHighlighted(int hilite) { d.hilite = hilite; }
 
+    QPixmap pixmap(const QSize& size, qreal ratio);
+
 protected:
+    void changeEvent(QEvent* event);
     void paintEvent(QPaintEvent* event);
     void drawBackground(QPainter* painter);
 
@@ -51,6 +55,7 @@ private:
     struct Private {
         int num;
         bool hilite;
+        WidgetCache cache;
     } d;
 };
 
@@ -88,10 +88,7 @@ void TreeDelegate::paint(QPainter* painter, const QStyleOptionViewItem& option,
         TreeHeader* header = TreeHeader::instance(const_cast<QWidget*>(option.widget));
         header->setText(index.data(Qt::DisplayRole).toString());
         header->setState(option.state);
-        header->setGeometry(option.rect);
-        painter->translate(option.rect.topLeft());
-        header->render(painter);
-        painter->translate(-option.rect.topLeft());
+        painter->drawPixmap(option.rect.topLeft(), header->pixmap(option.rect.size(), WidgetCache::devicePixelRatio(painter->device())));
         QStyle* style = option.widget->style();
         QIcon icon = index.data(Qt::DecorationRole).value<QIcon>();
         style->drawItemPixmap(painter, option.rect.translated(2, 0), Qt::AlignLeft | Qt::AlignVCenter, icon.pixmap(16, 16));
@@ -125,11 +122,7 @@ void TreeDelegate::paint(QPainter* painter, const QStyleOptionViewItem& option,
             TreeBadge* badge = TreeBadge::instance(hilite ? const_cast<QWidget*>(option.widget) : inactiveParent.data());
             badge->setNum(num);
             badge->setHighlighted(hilite);
-
-            badge->setGeometry(option.rect);
-            painter->translate(option.rect.topLeft());
-            badge->render(painter);
-            painter->translate(-option.rect.topLeft());
+            painter->drawPixmap(option.rect.topLeft(), badge->pixmap(option.rect.size(), WidgetCache::devicePixelRatio(painter->device())));
         }
     }
 }
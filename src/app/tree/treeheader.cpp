@@ -51,6 +51,25 @@ TreeHeader* TreeHeader::instance(QWidget* parent)
     return header;
 }
 
+QPixmap TreeHeader::pixmap(const QSize& size, qreal ratio)
+{
+    return d.cache.pixmap(this, size, ratio, QString::number(d.state) + QLatin1Char(':') + d.text);
+}
+
+void TreeHeader::changeEvent(QEvent* event)
+{
+    switch (event->type()) {
+    case QEvent::StyleChange:
+    case QEvent::PaletteChange:
+    case QEvent::FontChange:
+        d.cache.clear();
+        break;
+    default:
+        break;
+    }
+    QFrame::changeEvent(event);
+}
+
 void TreeHeader::paintEvent(QPaintEvent*)
 {
     QStyleOptionHeader option;
@@ -31,6 +31,7 @@
 
 #include <QFrame>
 #include <QStyle>
+#include "widgetcache.h"
 
 class TreeHeader : public QFrame
 {
@@ -44,13 +45,17 @@ public:
     void setText(const QString& text) { d.text = text; }
     void setState(QStyle::State state) { d.state = state; }
 
+    QPixmap pixmap(const QSize& size, qreal ratio);
+
 protected:
+    void changeEvent(QEvent* event);
     void paintEvent(QPaintEvent* event);
 
 private:
     struct Private {
         QString text;
         QStyle::State state;
+        WidgetCache cache;
     } d;
 };
 
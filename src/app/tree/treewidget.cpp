@@ -139,6 +139,46 @@ IrcBuffer* TreeWidget::currentBuffer() const
     return 0;
 }
 
+static bool hasMoreBadges(const QTreeWidgetItem* one, const QTreeWidgetItem* another)
+{
+    return one->data(1, TreeRole::Badge).toInt() > another->data(1, TreeRole::Badge).toInt();
+}
+
+QList<IrcBuffer*> TreeWidget::likelyBuffers(int count) const
+{
+    // where the user is most likely to go next: highlights first, then
+    // the next and previous active buffers, the neighbours of the current
+    // buffer, and finally whichever buffers have the most unread lines
+    QTreeWidgetItem* current = currentItem();
+    QList<QTreeWidgetItem*> items = d.highlightedItems.toList();
+    items += findNextItem(current, 1, TreeRole::Badge);
+    items += findPrevItem(current, 1, TreeRole::Badge);
+    items += nextItem(current);
+    items += previousItem(current);
+
+    QList<QTreeWidgetItem*> active;
+    QTreeWidgetItemIterator it(const_cast<TreeWidget*>(this));
+    while (*it) {
+        if ((*it)->data(1, TreeRole::Badge).toInt() > 0)
+            active += *it;
+        ++it;
+    }
+    qStableSort(active.begin(), active.end(), hasMoreBadges);
+    items += active;
+
+    QList<IrcBuffer*> buffers;
+    foreach (QTreeWidgetItem* item, items) {
+        if (buffers.count() >= count)
+            break;
+        if (item && item != current) {
+            IrcBuffer* buffer = static_cast<TreeItem*>(item)->buffer();
+            if (buffer && !buffers.contains(buffer))
+                buffers += buffer;
+        }
+    }
+    return buffers;
+}
+
 TreeItem* TreeWidget::bufferItem(IrcBuffer* buffer) const
 {
     return d.bufferItems.value(buffer);
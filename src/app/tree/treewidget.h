@@ -53,6 +53,7 @@ public:
     explicit TreeWidget(QWidget* parent = 0);
 
     IrcBuffer* currentBuffer() const;
+    QList<IrcBuffer*> likelyBuffers(int count) const;
     TreeItem* bufferItem(IrcBuffer* buffer) const;
     TreeItem* connectionItem(IrcConnection* connection) const;
 
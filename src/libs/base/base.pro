@@ -12,26 +12,52 @@ DEPENDPATH += $$PWD
 INCLUDEPATH += $$PWD
 
 HEADERS += $$PWD/bufferview.h
+HEADERS += $$PWD/eventaggregate.h
 HEADERS += $$PWD/eventformatter.h
+HEADERS += $$PWD/flushscheduler.h
+HEADERS += $$PWD/linetemplate.h
 HEADERS += $$PWD/listview.h
+HEADERS += $$PWD/messagecontext.h
 HEADERS += $$PWD/messagedata.h
+HEADERS += $$PWD/messagedispatcher.h
 HEADERS += $$PWD/messageformatter.h
+HEADERS += $$PWD/messagelog.h
+HEADERS += $$PWD/messagepipeline.h
+HEADERS += $$PWD/messagering.h
+HEADERS += $$PWD/messagestore.h
+HEADERS += $$PWD/nickmatcher.h
 HEADERS += $$PWD/textbrowser.h
 HEADERS += $$PWD/textdocument.h
 HEADERS += $$PWD/textinput.h
+HEADERS += $$PWD/textruns.h
 HEADERS += $$PWD/themeinfo.h
 HEADERS += $$PWD/titlebar.h
+HEADERS += $$PWD/userindex.h
+HEADERS += $$PWD/widgetcache.h
 
 SOURCES += $$PWD/bufferview.cpp
+SOURCES += $$PWD/eventaggregate.cpp
 SOURCES += $$PWD/eventformatter.cpp
+SOURCES += $$PWD/flushscheduler.cpp
+SOURCES += $$PWD/linetemplate.cpp
 SOURCES += $$PWD/listview.cpp
+SOURCES += $$PWD/messagecontext.cpp
 SOURCES += $$PWD/messagedata.cpp
+SOURCES += $$PWD/messagedispatcher.cpp
 SOURCES += $$PWD/messageformatter.cpp
+SOURCES += $$PWD/messagelog.cpp
+SOURCES += $$PWD/messagepipeline.cpp
+SOURCES += $$PWD/messagering.cpp
+SOURCES += $$PWD/messagestore.cpp
+SOURCES += $$PWD/nickmatcher.cpp
 SOURCES += $$PWD/textbrowser.cpp
 SOURCES += $$PWD/textdocument.cpp
 SOURCES += $$PWD/textinput.cpp
+SOURCES += $$PWD/textruns.cpp
 SOURCES += $$PWD/themeinfo.cpp
 SOURCES += $$PWD/titlebar.cpp
+SOURCES += $$PWD/userindex.cpp
+SOURCES += $$PWD/widgetcache.cpp
 
 include(shared/shared.pri)
 include(plugins/plugins.pri)
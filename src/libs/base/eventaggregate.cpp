@@ -0,0 +1,116 @@
+/*
+  Copyright (C) 2008-2015 The Communi Project
+
+  You may use this file under the terms of BSD license as follows:
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "eventaggregate.h"
+#include "messagedata.h"
+
+EventAggregate::EventAggregate()
+{
+    for (int i = 0; i < ActionCount; ++i)
+        d.counts[i] = 0;
+}
+
+EventAggregate::Action EventAggregate::action(const MessageData& event)
+{
+    switch (event.type()) {
+    case IrcMessage::Join:
+        return event.split().isEmpty() ? Joined : Rejoined;
+    case IrcMessage::Part:
+        return Left;
+    case IrcMessage::Quit:
+        if (event.isError())
+            return Disconnected;
+        return event.split().isEmpty() ? Quit : Split;
+    case IrcMessage::Kick:
+        return Kicked;
+    case IrcMessage::Nick:
+        return ChangedNick;
+    case IrcMessage::Mode:
+        return ChangedMode;
+    case IrcMessage::Topic:
+    default:
+        return ChangedTopic;
+    }
+}
+
+int EventAggregate::count() const
+{
+    return d.events.count();
+}
+
+int EventAggregate::count(Action action) const
+{
+    return d.counts[action];
+}
+
+QList<EventAggregate::Action> EventAggregate::actions() const
+{
+    return d.actions;
+}
+
+QString EventAggregate::servers() const
+{
+    return d.servers;
+}
+
+QStringList EventAggregate::nicks() const
+{
+    return d.nicks;
+}
+
+QList<MessageData> EventAggregate::events() const
+{
+    return d.events;
+}
+
+MessageData EventAggregate::event(int index) const
+{
+    return d.events.at(index);
+}
+
+void EventAggregate::add(const MessageData& event)
+{
+    // the summary is rendered from these counts, so adding
+    // an event does not depend on how many came before it
+    const Action act = action(event);
+    if (!d.counts[act]++)
+        d.actions += act;
+    if (!event.split().isEmpty())
+        d.servers = event.split();
+    if (!d.seen.contains(event.nick())) {
+        d.seen.insert(event.nick());
+        d.nicks += event.nick();
+    }
+    d.events += event;
+}
+
+void EventAggregate::setDetail(int index, const QString& detail)
+{
+    // detaches the event from the copies other buffers hold
+    d.events[index].setDetail(detail);
+}
@@ -0,0 +1,83 @@
+/*
+  Copyright (C) 2008-2015 The Communi Project
+
+  You may use this file under the terms of BSD license as follows:
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef EVENTAGGREGATE_H
+#define EVENTAGGREGATE_H
+
+#include <QSet>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+class MessageData;
+
+class EventAggregate
+{
+public:
+    EventAggregate();
+
+    enum Action {
+        Joined,
+        Left,
+        Quit,
+        Split,
+        Rejoined,
+        Disconnected,
+        Kicked,
+        ChangedNick,
+        ChangedMode,
+        ChangedTopic,
+        ActionCount
+    };
+
+    static Action action(const MessageData& event);
+
+    int count() const;
+    int count(Action action) const;
+    QList<Action> actions() const;
+
+    QString servers() const;
+    QStringList nicks() const;
+    QList<MessageData> events() const;
+    MessageData event(int index) const;
+
+    void add(const MessageData& event);
+    void setDetail(int index, const QString& detail);
+
+private:
+    struct Private {
+        QString servers;
+        QStringList nicks;
+        QSet<QString> seen;
+        QList<Action> actions;
+        QList<MessageData> events;
+        int counts[ActionCount];
+    } d;
+};
+
+#endif // EVENTAGGREGATE_H
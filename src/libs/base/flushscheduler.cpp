@@ -0,0 +1,230 @@
+/*
+  Copyright (C) 2008-2015 The Communi Project
+
+  You may use this file under the terms of BSD license as follows:
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "flushscheduler.h"
+#include "messagestore.h"
+#include "textdocument.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTimerEvent>
+#include <QEvent>
+
+// idle work waits for the user to stop typing or scrolling, and
+// then goes through the predicted documents one at a time
+static const int IdleDelay = 250;
+static const int IdleInterval = 50;
+
+static QDateTime activity(const TextDocument* document)
+{
+    const MessageStore* store = document->store();
+    return store->isEmpty() ? QDateTime() : store->last().timestamp();
+}
+
+static bool isMoreUrgent(const TextDocument* one, const TextDocument* another)
+{
+    if (one->isVisible() != another->isVisible())
+        return one->isVisible();
+    const bool highlighted = one->hasPendingHighlight();
+    if (highlighted != another->hasPendingHighlight())
+        return highlighted;
+    return activity(one) > activity(another);
+}
+
+FlushScheduler::FlushScheduler(QObject* parent) : QObject(parent)
+{
+    d.idle = 0;
+    d.timer = 0;
+    d.budget = 4;
+    d.backlog = 0;
+    d.input.start();
+    if (parent)
+        parent->installEventFilter(this);
+}
+
+FlushScheduler* FlushScheduler::instance()
+{
+    static FlushScheduler* scheduler = 0;
+    if (!scheduler)
+        scheduler = new FlushScheduler(QCoreApplication::instance());
+    return scheduler;
+}
+
+int FlushScheduler::budget() const
+{
+    return d.budget;
+}
+
+void FlushScheduler::setBudget(int msecs)
+{
+    d.budget = qMax(1, msecs);
+}
+
+int FlushScheduler::backlog() const
+{
+    return d.backlog;
+}
+
+bool FlushScheduler::isScheduled(TextDocument* document) const
+{
+    return d.documents.contains(document);
+}
+
+QList<TextDocument*> FlushScheduler::predicted() const
+{
+    QList<TextDocument*> documents;
+    foreach (TextDocument* document, d.predicted) {
+        if (document)
+            documents += document;
+    }
+    return documents;
+}
+
+void FlushScheduler::setPredicted(const QList<TextDocument*>& documents)
+{
+    // the documents most likely to be shown next, in order. their
+    // stores keep formatting ahead on the pipeline meanwhile.
+    foreach (MessageStore* store, d.expected) {
+        if (store)
+            store->setExpected(false);
+    }
+    d.expected.clear();
+    d.predicted.clear();
+    foreach (TextDocument* document, documents) {
+        d.predicted += document;
+        if (document) {
+            document->store()->setExpected(true);
+            d.expected += document->store();
+        }
+    }
+    if (!d.predicted.isEmpty() && !d.idle)
+        d.idle = startTimer(IdleInterval);
+}
+
+void FlushScheduler::schedule(TextDocument* document)
+{
+    if (document && !d.documents.contains(document)) {
+        d.documents += document;
+        connect(document, SIGNAL(destroyed(QObject*)), this, SLOT(onDestroyed(QObject*)));
+        if (!d.timer)
+            d.timer = startTimer(0);
+        updateBacklog();
+    }
+}
+
+void FlushScheduler::cancel(TextDocument* document)
+{
+    if (d.documents.removeOne(document)) {
+        disconnect(document, SIGNAL(destroyed(QObject*)), this, SLOT(onDestroyed(QObject*)));
+        updateBacklog();
+    }
+}
+
+bool FlushScheduler::eventFilter(QObject* object, QEvent* event)
+{
+    switch (event->type()) {
+    case QEvent::KeyPress:
+    case QEvent::MouseButtonPress:
+    case QEvent::MouseMove:
+    case QEvent::Wheel:
+    case QEvent::TouchBegin:
+    case QEvent::TouchUpdate:
+        d.input.restart();
+        break;
+    default:
+        break;
+    }
+    return QObject::eventFilter(object, event);
+}
+
+void FlushScheduler::timerEvent(QTimerEvent* event)
+{
+    if (event->timerId() == d.idle) {
+        // idle work yields to pending flushes and to the user
+        if (d.documents.isEmpty() && d.input.elapsed() >= IdleDelay)
+            prepareNext();
+        if (d.predicted.isEmpty()) {
+            killTimer(d.idle);
+            d.idle = 0;
+        }
+        return;
+    }
+
+    if (event->timerId() == d.timer) {
+        // flush as many documents as fit in the budget and leave the rest
+        // for the next round, so that the event loop keeps spinning
+        QElapsedTimer elapsed;
+        elapsed.start();
+        while (!d.documents.isEmpty() && elapsed.elapsed() < d.budget) {
+            TextDocument* document = takeNext();
+            disconnect(document, SIGNAL(destroyed(QObject*)), this, SLOT(onDestroyed(QObject*)));
+            document->flush();
+        }
+        if (d.documents.isEmpty()) {
+            killTimer(d.timer);
+            d.timer = 0;
+        }
+        updateBacklog();
+    }
+}
+
+void FlushScheduler::onDestroyed(QObject* object)
+{
+    d.documents.removeAll(static_cast<TextDocument*>(object));
+    updateBacklog();
+}
+
+TextDocument* FlushScheduler::takeNext()
+{
+    int index = 0;
+    for (int i = 1; i < d.documents.count(); ++i) {
+        if (isMoreUrgent(d.documents.at(i), d.documents.at(index)))
+            index = i;
+    }
+    return d.documents.takeAt(index);
+}
+
+void FlushScheduler::prepareNext()
+{
+    // one document per round, the rest waits for the next idle round
+    while (!d.predicted.isEmpty()) {
+        TextDocument* document = d.predicted.takeFirst();
+        if (document && document->prepare())
+            break;
+    }
+}
+
+void FlushScheduler::updateBacklog()
+{
+    int backlog = 0;
+    foreach (TextDocument* document, d.documents)
+        backlog += document->pendingCount();
+    if (d.backlog != backlog) {
+        d.backlog = backlog;
+        emit backlogChanged(backlog);
+    }
+}
@@ -0,0 +1,91 @@
+/*
+  Copyright (C) 2008-2015 The Communi Project
+
+  You may use this file under the terms of BSD license as follows:
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef FLUSHSCHEDULER_H
+#define FLUSHSCHEDULER_H
+
+#include <QList>
+#include <QObject>
+#include <QPointer>
+#include <QElapsedTimer>
+
+class MessageStore;
+class TextDocument;
+
+class FlushScheduler : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(int budget READ budget WRITE setBudget)
+    Q_PROPERTY(int backlog READ backlog NOTIFY backlogChanged)
+
+public:
+    static FlushScheduler* instance();
+
+    int budget() const;
+    void setBudget(int msecs);
+
+    int backlog() const;
+    bool isScheduled(TextDocument* document) const;
+
+    QList<TextDocument*> predicted() const;
+    void setPredicted(const QList<TextDocument*>& documents);
+
+public slots:
+    void schedule(TextDocument* document);
+    void cancel(TextDocument* document);
+
+signals:
+    void backlogChanged(int backlog);
+
+protected:
+    bool eventFilter(QObject* object, QEvent* event);
+    void timerEvent(QTimerEvent* event);
+
+private slots:
+    void onDestroyed(QObject* object);
+
+private:
+    explicit FlushScheduler(QObject* parent = 0);
+
+    TextDocument* takeNext();
+    void updateBacklog();
+    void prepareNext();
+
+    struct Private {
+        int idle;
+        int timer;
+        int budget;
+        int backlog;
+        QElapsedTimer input;
+        QList<TextDocument*> documents;
+        QList<QPointer<TextDocument> > predicted;
+        QList<QPointer<MessageStore> > expected;
+    } d;
+};
+
+#endif // FLUSHSCHEDULER_H
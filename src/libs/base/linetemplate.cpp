@@ -0,0 +1,112 @@
+/*
+  Copyright (C) 2008-2015 The Communi Project
+
+  You may use this file under the terms of BSD license as follows:
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "linetemplate.h"
+
+LineTemplate::LineTemplate()
+{
+    d.length = 0;
+}
+
+LineTemplate::LineTemplate(const QString& pattern)
+{
+    // split once into literal text and %1-%9 placeholders, so that
+    // filling in a line is a matter of appending the pieces
+    d.length = 0;
+    QString literal;
+    const int len = pattern.length();
+    for (int i = 0; i < len; ++i) {
+        const QChar c = pattern.at(i);
+        if (c == QLatin1Char('%') && i + 1 < len && pattern.at(i + 1) >= QLatin1Char('1') && pattern.at(i + 1) <= QLatin1Char('9')) {
+            if (!literal.isEmpty()) {
+                Segment segment = { -1, literal };
+                d.segments += segment;
+                d.length += literal.length();
+                literal.clear();
+            }
+            Segment segment = { pattern.at(++i).digitValue() - 1, QString() };
+            d.segments += segment;
+        } else {
+            literal += c;
+        }
+    }
+    if (!literal.isEmpty()) {
+        Segment segment = { -1, literal };
+        d.segments += segment;
+        d.length += literal.length();
+    }
+}
+
+bool LineTemplate::isEmpty() const
+{
+    return d.segments.isEmpty();
+}
+
+QString LineTemplate::arg(const QString& a1) const
+{
+    return fill(&a1, 1);
+}
+
+QString LineTemplate::arg(const QString& a1, const QString& a2) const
+{
+    const QString args[] = { a1, a2 };
+    return fill(args, 2);
+}
+
+QString LineTemplate::arg(const QString& a1, const QString& a2, const QString& a3) const
+{
+    const QString args[] = { a1, a2, a3 };
+    return fill(args, 3);
+}
+
+QString LineTemplate::arg(const QString& a1, const QString& a2, const QString& a3, const QString& a4) const
+{
+    const QString args[] = { a1, a2, a3, a4 };
+    return fill(args, 4);
+}
+
+QString LineTemplate::fill(const QString* args, int count) const
+{
+    int length = d.length;
+    foreach (const Segment& segment, d.segments) {
+        if (segment.arg >= 0 && segment.arg < count)
+            length += args[segment.arg].length();
+    }
+
+    QString str;
+    str.reserve(length);
+    foreach (const Segment& segment, d.segments) {
+        if (segment.arg < 0)
+            str += segment.text;
+        else if (segment.arg < count)
+            str += args[segment.arg];
+        else
+            str += QLatin1Char('%') + QString::number(segment.arg + 1);
+    }
+    return str;
+}
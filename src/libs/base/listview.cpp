@@ -27,9 +27,10 @@
 */
 
 #include "listview.h"
+#include "userindex.h"
 #include <QStyledItemDelegate>
 #include <QContextMenuEvent>
-#include <IrcUserModel>
+#include <QItemSelectionModel>
 #include <QFontMetrics>
 #include <QScrollBar>
 #include <IrcCommand>
@@ -62,22 +63,33 @@ ListView::ListView(QWidget* parent) : QListView(parent)
 #endif
     setItemDelegate(new ListDelegate(this));
 
-    d.model = new IrcUserModel(this);
-    d.model->setSortMethod(Irc::SortByTitle);
-    setModel(d.model);
+    d.index = 0;
 
     connect(this, SIGNAL(doubleClicked(QModelIndex)), this, SLOT(onDoubleClicked(QModelIndex)));
 }
 
+ListView::~ListView()
+{
+    if (d.index)
+        d.index->release();
+}
+
 IrcChannel* ListView::channel() const
 {
-    return d.model->channel();
+    return d.index ? d.index->channel() : 0;
 }
 
 void ListView::setChannel(IrcChannel* channel)
 {
-    if (d.model->channel() != channel) {
-        d.model->setChannel(channel);
+    if (this->channel() != channel) {
+        // the sorted user model is shared by every view on the channel
+        UserIndex* index = UserIndex::acquire(channel);
+        QItemSelectionModel* selection = selectionModel();
+        setModel(index ? index->model() : 0);
+        delete selection;
+        if (d.index)
+            d.index->release();
+        d.index = index;
         emit channelChanged(channel);
     }
 }
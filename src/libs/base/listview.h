@@ -32,7 +32,7 @@
 #include <QListView>
 
 class IrcChannel;
-class IrcUserModel;
+class UserIndex;
 
 class ListView : public QListView
 {
@@ -41,6 +41,7 @@ class ListView : public QListView
 
 public:
     explicit ListView(QWidget* parent = 0);
+    ~ListView();
 
     IrcChannel* channel() const;
 
@@ -68,7 +69,7 @@ private:
     QMenu* createContextMenu(const QModelIndex& index);
 
     struct Private {
-        IrcUserModel* model;
+        UserIndex* index;
     } d;
 };
 
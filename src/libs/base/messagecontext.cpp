@@ -0,0 +1,171 @@
+/*
+  Copyright (C) 2008-2015 The Communi Project
+
+  You may use this file under the terms of BSD license as follows:
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "messagecontext.h"
+#include <QBitArray>
+#include <QHash>
+#include <Irc>
+
+static const int MaxCode = 1000;
+
+static QBitArray createErrorCodes()
+{
+    QBitArray codes(MaxCode);
+    for (int i = 0; i < MaxCode; ++i)
+        codes.setBit(i, Irc::codeToString(i).startsWith("ERR_"));
+    return codes;
+}
+
+static QHash<QString, IrcMessage::Type> createIntents()
+{
+    QHash<QString, IrcMessage::Type> intents;
+    intents.insert("JOIN", IrcMessage::Join);
+    intents.insert("PART", IrcMessage::Part);
+    intents.insert("QUIT", IrcMessage::Quit);
+    intents.insert("NICK", IrcMessage::Nick);
+    intents.insert("MODE", IrcMessage::Mode);
+    intents.insert("TOPIC", IrcMessage::Topic);
+    intents.insert("KICK", IrcMessage::Kick);
+    return intents;
+}
+
+MessageContext::MessageContext()
+{
+    d.error = false;
+    d.reply = false;
+    d.type = IrcMessage::Unknown;
+    d.styleClass = "unknown";
+    d.message = 0;
+}
+
+MessageContext::MessageContext(const IrcMessage* msg)
+{
+    // everything the formatter and the line need to know about the
+    // kind of the message, worked out once instead of at every stage
+    d.message = msg;
+    d.error = false;
+    d.reply = msg->property("reply").toBool();
+
+    d.type = msg->type();
+    const QVariant intent = msg->tag("intent");
+    if (intent.isValid()) {
+        const IrcMessage::Type type = intentType(intent.toString());
+        if (type != IrcMessage::Unknown)
+            d.type = type;
+    }
+
+    d.styleClass = "message";
+    switch (d.type) {
+        case IrcMessage::Away:
+        case IrcMessage::Invite:
+        case IrcMessage::Join:
+        case IrcMessage::Kick:
+        case IrcMessage::Mode:
+        case IrcMessage::Motd:
+        case IrcMessage::Names:
+        case IrcMessage::Nick:
+        case IrcMessage::Part:
+        case IrcMessage::Pong:
+        case IrcMessage::Topic:
+        case IrcMessage::Whois:
+        case IrcMessage::Whowas:
+        case IrcMessage::WhoReply:
+            d.styleClass = "event";
+            break;
+        case IrcMessage::Quit:
+            d.styleClass = "event";
+            if (msg->type() == IrcMessage::Quit)
+                d.error = isDisconnect(static_cast<const IrcQuitMessage*>(msg)->reason());
+            break;
+        case IrcMessage::Unknown:
+            d.styleClass = "unknown";
+            break;
+        case IrcMessage::Notice:
+            d.styleClass = static_cast<const IrcNoticeMessage*>(msg)->isReply() ? "event" : "notice";
+            break;
+        case IrcMessage::Private: {
+            const IrcPrivateMessage* m = static_cast<const IrcPrivateMessage*>(msg);
+            d.styleClass = m->isAction() ? "action" : m->isRequest() ? "event" : "message";
+            break;
+        }
+        case IrcMessage::Numeric:
+            d.error = isErrorCode(static_cast<const IrcNumericMessage*>(msg)->code());
+            d.styleClass = d.error ? "notice" : "event";
+            break;
+        case IrcMessage::Error:
+            d.error = true;
+            d.styleClass = "notice";
+            break;
+        default:
+            break;
+    }
+}
+
+const IrcMessage* MessageContext::message() const
+{
+    return d.message;
+}
+
+IrcMessage::Type MessageContext::type() const
+{
+    return d.type;
+}
+
+QString MessageContext::styleClass() const
+{
+    return QString::fromLatin1(d.styleClass);
+}
+
+bool MessageContext::isError() const
+{
+    return d.error;
+}
+
+bool MessageContext::isReply() const
+{
+    return d.reply;
+}
+
+IrcMessage::Type MessageContext::intentType(const QString& intent)
+{
+    static const QHash<QString, IrcMessage::Type> intents = createIntents();
+    return intents.value(intent, IrcMessage::Unknown);
+}
+
+bool MessageContext::isErrorCode(int code)
+{
+    static const QBitArray codes = createErrorCodes();
+    return code >= 0 && code < MaxCode && codes.testBit(code);
+}
+
+bool MessageContext::isDisconnect(const QString& reason)
+{
+    return reason.contains("Ping timeout")
+            || reason.contains("Connection reset by peer")
+            || reason.contains("Remote host closed the connection");
+}
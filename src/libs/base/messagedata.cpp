@@ -27,124 +27,259 @@
 */
 
 #include "messagedata.h"
+#include "messagecontext.h"
+#include "eventaggregate.h"
+#include <QStringList>
+#include <QMutex>
+#include <QSet>
 
-MessageData::MessageData()
+static const int MaxInterned = 65536;
+
+// lines such as date separators have no time of their own
+static const qint64 NoTimestamp = -1;
+
+static bool isServer(const QString& name)
+{
+    if (name.isEmpty() || !name.contains(QLatin1Char('.')))
+        return false;
+    foreach (const QChar& c, name) {
+        if (!c.isLetterOrNumber() && c != QLatin1Char('.') && c != QLatin1Char('-') && c != QLatin1Char('*'))
+            return false;
+    }
+    return !name.startsWith(QLatin1Char('.')) && !name.endsWith(QLatin1Char('.'));
+}
+
+// one record is shared by every copy of a line, the ring, the blocks
+// of the documents showing it and whatever queue it passes through
+class MessageDataPrivate : public QSharedData
+{
+public:
+    MessageDataPrivate() : own(false), error(false), reply(false), deferred(false),
+        type(IrcMessage::Unknown), timestamp(NoTimestamp) { }
+
+    bool own : 1;
+    bool error : 1;
+    bool reply : 1;
+    bool deferred : 1;
+    IrcMessage::Type type;
+    qint64 timestamp;
+    QString nick;
+    QString split;
+    QString format;
+    QString detail;
+    TextRuns runs;
+    QByteArray data;
+    QSharedPointer<EventAggregate> events;
+};
+
+static QSharedDataPointer<MessageDataPrivate> sharedNull()
+{
+    static QSharedDataPointer<MessageDataPrivate> null(new MessageDataPrivate);
+    return null;
+}
+
+// nicks repeat across lines, buffers and connections,
+// so they all share the same string data
+static QString intern(const QString& str)
+{
+    static QMutex mutex;
+    static QSet<QString> strings;
+
+    QMutexLocker locker(&mutex);
+    QSet<QString>::const_iterator it = strings.constFind(str);
+    if (it != strings.constEnd())
+        return *it;
+    if (strings.count() >= MaxInterned)
+        strings.clear();
+    strings.insert(str);
+    return str;
+}
+
+MessageData::MessageData() : d(sharedNull())
+{
+}
+
+MessageData::MessageData(const MessageData& other) : d(other.d)
+{
+}
+
+MessageData& MessageData::operator=(const MessageData& other)
+{
+    d = other.d;
+    return *this;
+}
+
+MessageData::~MessageData()
 {
-    d.own = false;
-    d.error = false;
-    d.reply = false;
-    d.type = IrcMessage::Unknown;
 }
 
 IrcMessage::Type MessageData::effectiveType(const IrcMessage* msg)
 {
-    QString intent = msg->tag("intent").toString();
-    if (!intent.isEmpty()) {
-        if (intent == "JOIN")
-            return IrcMessage::Join;
-        if (intent == "PART")
-            return IrcMessage::Part;
-        if (intent == "QUIT")
-            return IrcMessage::Quit;
-        if (intent == "NICK")
-            return IrcMessage::Nick;
-        if (intent == "MODE")
-            return IrcMessage::Mode;
-        if (intent == "TOPIC")
-            return IrcMessage::Topic;
-        if (intent == "KICK")
-            return IrcMessage::Kick;
+    const QVariant intent = msg->tag("intent");
+    if (intent.isValid()) {
+        const IrcMessage::Type type = MessageContext::intentType(intent.toString());
+        if (type != IrcMessage::Unknown)
+            return type;
     }
     return msg->type();
 }
 
+IrcMessage* MessageData::parseMessage(const QByteArray& data, const QDateTime& timestamp, IrcConnection* connection)
+{
+    // the message keeps the bytes it was parsed from, so
+    // that classifying it does not serialize it all over
+    IrcMessage* msg = IrcMessage::fromData(data, connection);
+    if (msg) {
+        msg->setTimeStamp(timestamp);
+        msg->setProperty("raw", data);
+    }
+    return msg;
+}
+
+IrcMessage* MessageData::toMessage(IrcConnection* connection) const
+{
+    return parseMessage(d->data, timestamp(), connection);
+}
+
 bool MessageData::isEmpty() const
 {
-    return d.format.isEmpty();
+    return d->format.isEmpty() && !d->deferred;
+}
+
+bool MessageData::isDeferred() const
+{
+    return d->deferred;
 }
 
 bool MessageData::isEvent() const
 {
-    return !d.reply &&
-           (d.type == IrcMessage::Join ||
-            d.type == IrcMessage::Kick ||
-            d.type == IrcMessage::Mode ||
-            d.type == IrcMessage::Nick ||
-            d.type == IrcMessage::Part ||
-            d.type == IrcMessage::Quit ||
-            d.type == IrcMessage::Topic);
+    return !d->reply &&
+           (d->type == IrcMessage::Join ||
+            d->type == IrcMessage::Kick ||
+            d->type == IrcMessage::Mode ||
+            d->type == IrcMessage::Nick ||
+            d->type == IrcMessage::Part ||
+            d->type == IrcMessage::Quit ||
+            d->type == IrcMessage::Topic);
 }
 
 bool MessageData::isError() const
 {
-    return d.error || d.type == IrcMessage::Error;
+    return d->error || d->type == IrcMessage::Error;
 }
 
 QList<MessageData> MessageData::getEvents() const
 {
-    QList<MessageData> events = d.events;
-    if (events.isEmpty())
-        events += *this;
-    return events;
+    if (d->events)
+        return d->events->events();
+    return QList<MessageData>() << *this;
 }
 
-bool MessageData::canMerge(const MessageData& other) const
+QSharedPointer<EventAggregate> MessageData::aggregate() const
 {
-    return isEvent() && (!d.own || d.type != IrcMessage::Join)
-           && other.isEvent() && (!other.d.own || other.d.type != IrcMessage::Join)
-           && d.timestamp.date() == other.d.timestamp.date();
+    return d->events;
 }
 
-void MessageData::merge(const MessageData& other)
+void MessageData::setAggregate(const QSharedPointer<EventAggregate>& aggregate)
 {
-    d.events = other.getEvents() << *this;
+    d->events = aggregate;
+}
+
+bool MessageData::canMerge(const MessageData& other) const
+{
+    return isEvent() && (!d->own || d->type != IrcMessage::Join)
+           && other.isEvent() && (!other.d->own || other.d->type != IrcMessage::Join)
+           && timestamp().date() == other.timestamp().date();
 }
 
 void MessageData::initFrom(IrcMessage* message)
 {
-    d.timestamp = message->timeStamp();
-    d.data = message->toData();
-    d.nick = message->nick();
-    d.type = effectiveType(message);
-    d.own = message->isOwn();
-    d.reply = message->property("reply").toBool();
+    initFrom(message, MessageContext(message));
+}
+
+void MessageData::initFrom(IrcMessage* message, const MessageContext& context)
+{
+    const QDateTime timestamp = message->timeStamp();
+    d->timestamp = timestamp.isValid() ? timestamp.toMSecsSinceEpoch() : NoTimestamp;
+    const QVariant raw = message->property("raw");
+    d->data = raw.isValid() ? raw.toByteArray() : message->toData();
+    d->nick = intern(message->nick());
+    d->type = context.type();
+    d->own = message->isOwn();
+    d->reply = context.isReply();
 
     if (message->type() == IrcMessage::Quit) {
-        QString reason = static_cast<IrcQuitMessage*>(message)->reason();
-        if (reason.contains("Ping timeout")
-                || reason.contains("Connection reset by peer")
-                || reason.contains("Remote host closed the connection")) {
-            d.error = true;
+        d->error = context.isError();
+        if (!d->error) {
+            // netsplits quit with the names of the servers that split
+            const QString reason = static_cast<IrcQuitMessage*>(message)->reason();
+            const QStringList servers = reason.split(QLatin1Char(' '));
+            if (servers.count() == 2 && isServer(servers.first()) && isServer(servers.last()))
+                d->split = reason;
         }
     }
 }
 
 QString MessageData::format() const
 {
-    return d.format;
+    return d->format;
 }
 
 void MessageData::setFormat(const QString& format)
 {
-    d.format = format;
+    d->format = format;
+    d->runs = TextRuns::fromHtml(format);
+    d->deferred = false;
+}
+
+TextRuns MessageData::runs() const
+{
+    return d->runs;
+}
+
+void MessageData::setDeferred(bool deferred)
+{
+    d->deferred = deferred;
 }
 
 QString MessageData::nick() const
 {
-    return d.nick;
+    return d->nick;
+}
+
+QString MessageData::detail() const
+{
+    return d->detail;
+}
+
+void MessageData::setDetail(const QString& detail)
+{
+    d->detail = detail;
+}
+
+QString MessageData::split() const
+{
+    return d->split;
+}
+
+void MessageData::setSplit(const QString& servers)
+{
+    d->split = servers;
 }
 
 QByteArray MessageData::data() const
 {
-    return d.data;
+    return d->data;
 }
 
 QDateTime MessageData::timestamp() const
 {
-    return d.timestamp;
+    if (d->timestamp == NoTimestamp)
+        return QDateTime();
+    return QDateTime::fromMSecsSinceEpoch(d->timestamp);
 }
 
 IrcMessage::Type MessageData::type() const
 {
-    return d.type;
+    return d->type;
 }
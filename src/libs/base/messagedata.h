@@ -33,43 +33,59 @@
 #include <QString>
 #include <QDateTime>
 #include <IrcMessage>
+#include <QSharedPointer>
+#include <QSharedDataPointer>
+#include "textruns.h"
+
+class IrcConnection;
+class EventAggregate;
+class MessageContext;
+class MessageDataPrivate;
 
 class MessageData
 {
 public:
     MessageData();
+    MessageData(const MessageData& other);
+    MessageData& operator=(const MessageData& other);
+    ~MessageData();
 
     static IrcMessage::Type effectiveType(const IrcMessage* msg);
+    static IrcMessage* parseMessage(const QByteArray& data, const QDateTime& timestamp, IrcConnection* connection = 0);
+
+    IrcMessage* toMessage(IrcConnection* connection = 0) const;
 
     bool isEmpty() const;
+    bool isDeferred() const;
     bool isEvent() const;
     bool isError() const;
 
     QList<MessageData> getEvents() const;
+    QSharedPointer<EventAggregate> aggregate() const;
+    void setAggregate(const QSharedPointer<EventAggregate>& aggregate);
     bool canMerge(const MessageData& other) const;
-    void merge(const MessageData& other);
     void initFrom(IrcMessage* message);
+    void initFrom(IrcMessage* message, const MessageContext& context);
 
     QString format() const;
     void setFormat(const QString& format);
+    TextRuns runs() const;
+    void setDeferred(bool deferred);
 
     QString nick() const;
+
+    QString detail() const;
+    void setDetail(const QString& detail);
+
+    QString split() const;
+    void setSplit(const QString& servers);
+
     QByteArray data() const;
     QDateTime timestamp() const;
     IrcMessage::Type type() const;
 
 private:
-    struct Private {
-        bool own;
-        bool error;
-        bool reply;
-        QString nick;
-        QString format;
-        QByteArray data;
-        QDateTime timestamp;
-        IrcMessage::Type type;
-        QList<MessageData> events;
-    } d;
+    QSharedDataPointer<MessageDataPrivate> d;
 };
 
 #endif // MESSAGEDATA_H
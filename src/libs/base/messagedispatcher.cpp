@@ -0,0 +1,76 @@
+/*
+  Copyright (C) 2008-2015 The Communi Project
+
+  You may use this file under the terms of BSD license as follows:
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "messagedispatcher.h"
+#include "messageformatter.h"
+#include <IrcConnection>
+#include <IrcMessage>
+
+MessageDispatcher::MessageDispatcher(IrcConnection* connection) : QObject(connection)
+{
+    d.connection = connection;
+    d.formatter = new MessageFormatter(this);
+}
+
+MessageDispatcher* MessageDispatcher::instance(IrcConnection* connection)
+{
+    if (!connection)
+        return 0;
+
+    MessageDispatcher* dispatcher = connection->findChild<MessageDispatcher*>(QString(), Qt::FindDirectChildrenOnly);
+    if (!dispatcher)
+        dispatcher = new MessageDispatcher(connection);
+    return dispatcher;
+}
+
+IrcConnection* MessageDispatcher::connection() const
+{
+    return d.connection;
+}
+
+MessageData MessageDispatcher::dispatch(IrcMessage* message)
+{
+    // the same message object is routed to every buffer the user
+    // shares with us, one after another. it is classified and,
+    // unless it depends on the buffer, formatted for the first
+    // one and the others get a copy of the same line.
+    const IrcMessage::Type type = MessageData::effectiveType(message);
+    if (type != IrcMessage::Quit && type != IrcMessage::Nick && type != IrcMessage::Away)
+        return MessageData();
+
+    if (d.message != message) {
+        d.message = message;
+        if (type == IrcMessage::Away && !static_cast<IrcAwayMessage*>(message)->content().isEmpty()) {
+            // the reason gets nicks linked per channel
+            d.data = d.formatter->classifyMessage(message);
+        } else {
+            d.data = d.formatter->formatMessage(message);
+        }
+    }
+    return d.data;
+}
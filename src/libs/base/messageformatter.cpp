@@ -27,6 +27,7 @@
 */
 
 #include "messageformatter.h"
+#include "userindex.h"
 #include <IrcTextFormat>
 #include <IrcConnection>
 #include <IrcUserModel>
@@ -38,7 +39,6 @@
 #include <QTime>
 #include <QColor>
 #include <QCoreApplication>
-#include <QTextBoundaryFinder>
 
 static QString formatSeconds(int secs)
 {
@@ -61,14 +61,36 @@ static QString formatDuration(int secs)
     return idle.join(" ");
 }
 
+// both depend on the connection, which a message being formatted
+// off the GUI thread does not have. the values are captured up front.
+template <typename T>
+static QString statusPrefix(T* msg)
+{
+    const QVariant prefix = msg->property("statusPrefix");
+    return prefix.isValid() ? prefix.toString() : msg->statusPrefix();
+}
+
+template <typename T>
+static bool isPrivate(T* msg)
+{
+    const QVariant priv = msg->property("private");
+    return priv.isValid() ? priv.toBool() : msg->isPrivate();
+}
+
 MessageFormatter::MessageFormatter(QObject* parent) : QObject(parent)
 {
+    d.plain = false;
     d.buffer = 0;
     d.textFormat = new IrcTextFormat(this);
     d.textFormat->setSpanFormat(IrcTextFormat::SpanClass);
 
-    d.userModel = new IrcUserModel(this);
-    connect(d.userModel, SIGNAL(namesChanged(QStringList)), this, SLOT(indexNames(QStringList)));
+    d.index = 0;
+}
+
+MessageFormatter::~MessageFormatter()
+{
+    if (d.index)
+        d.index->release();
 }
 
 IrcBuffer* MessageFormatter::buffer() const
@@ -80,7 +102,9 @@ void MessageFormatter::setBuffer(IrcBuffer* buffer)
 {
     if (d.buffer != buffer) {
         d.buffer = buffer;
-        d.userModel->setChannel(qobject_cast<IrcChannel*>(buffer));
+        if (d.index)
+            d.index->release();
+        d.index = UserIndex::acquire(qobject_cast<IrcChannel*>(buffer));
     }
 }
 
@@ -94,10 +118,48 @@ void MessageFormatter::setTextFormat(IrcTextFormat* format)
     d.textFormat = format;
 }
 
+NickMatcher MessageFormatter::names() const
+{
+    // a compiled copy is never written to again,
+    // so it can be handed over to another thread
+    const NickMatcher& names = d.index ? d.index->names() : d.names;
+    names.compile();
+    return names;
+}
+
+void MessageFormatter::setNames(const NickMatcher& names)
+{
+    d.names = names;
+}
+
+bool MessageFormatter::isPlain() const
+{
+    return d.plain;
+}
+
+void MessageFormatter::setPlain(bool plain)
+{
+    d.plain = plain;
+}
+
 MessageData MessageFormatter::formatMessage(IrcMessage* msg)
 {
     QString fmt;
-    switch (MessageData::effectiveType(msg)) {
+    d.context = MessageContext(msg);
+    switch (d.context.type()) {
+        case IrcMessage::Motd:
+        case IrcMessage::Names:
+        case IrcMessage::Whois:
+        case IrcMessage::Whowas:
+            // every line of a reply shares the same serialized message
+            if (!msg->property("raw").isValid())
+                msg->setProperty("raw", msg->toData());
+            break;
+        default:
+            break;
+    }
+
+    switch (d.context.type()) {
         case IrcMessage::Away:
             fmt = formatAwayMessage(static_cast<IrcAwayMessage*>(msg));
             break;
@@ -161,70 +223,108 @@ MessageData MessageFormatter::formatMessage(IrcMessage* msg)
         default:
             break;
     }
-    return formatClass(fmt, msg);
+    MessageData data = formatClass(fmt, msg);
+    // the message may be gone once this returns, and another one
+    // allocated at the same address must not pick up its context
+    d.context = MessageContext();
+    return data;
+}
+
+MessageData MessageFormatter::classifyMessage(IrcMessage* msg) const
+{
+    // messages that always format to exactly one line can have their
+    // formatting deferred, anything else is left for formatMessage()
+    MessageData data;
+    d.context = MessageContext(msg);
+    switch (d.context.type()) {
+        case IrcMessage::Away:
+        case IrcMessage::Error:
+        case IrcMessage::Invite:
+        case IrcMessage::Join:
+        case IrcMessage::Kick:
+        case IrcMessage::Mode:
+        case IrcMessage::Nick:
+        case IrcMessage::Notice:
+        case IrcMessage::Part:
+        case IrcMessage::Pong:
+        case IrcMessage::Private:
+        case IrcMessage::Quit:
+            data.initFrom(msg, d.context);
+            data.setDeferred(true);
+            break;
+        default:
+            break;
+    }
+    d.context = MessageContext();
+    return data;
 }
 
 QString MessageFormatter::formatText(const QString& text) const
 {
     d.textFormat->parse(text);
 
+    // no colors, links or nicks for buffers in firehose mode
+    if (d.plain)
+        return d.textFormat->plainText().toHtmlEscaped();
+
     QString msg = d.textFormat->html();
-    if (!d.names.isEmpty()) {
-        QTextBoundaryFinder finder = QTextBoundaryFinder(QTextBoundaryFinder::Word, msg);
+    QList<NickMatcher::Match> matches;
+    if (d.index)
+        matches = d.index->names().match(msg);
+    else
+        matches = d.names.match(msg);
+    if (!matches.isEmpty()) {
+        static const LineTemplate link(QLatin1String("<a style='text-decoration:none;' href='nick:%1'>%2</a>"));
+        QString linked;
         int pos = 0;
-        while (pos < msg.length()) {
-            const QChar c = msg.at(pos);
-            if (!c.isSpace()) {
-                // do not format nicks within links
-                if (c == '<' && msg.midRef(pos, 3) == "<a ") {
-                    const int end = msg.indexOf("</a>", pos + 3);
-                    if (end != -1) {
-                        pos = end + 4;
-                        continue;
-                    }
-                }
-                // test word start boundary
-                finder.setPosition(pos);
-                if (finder.isAtBoundary()) {
-                    QMultiHash<QChar, QString>::const_iterator it = d.names.find(c);
-                    while (it != d.names.constEnd() && it.key() == c) {
-                        const QString& user = it.value();
-                        if (msg.midRef(pos, user.length()) == user) {
-                            // test word end boundary
-                            finder.setPosition(pos + user.length());
-                            if (finder.isAtBoundary()) {
-                                const QString formatted = QString("<a style='text-decoration:none;' href='nick:%1'>%2</a>").arg(user, styledText(user, Bold | Color));
-                                msg.replace(pos, user.length(), formatted);
-                                pos += formatted.length();
-                                finder = QTextBoundaryFinder(QTextBoundaryFinder::Word, msg);
-                            }
-                        }
-                        ++it;
-                    }
-                }
-            }
-            ++pos;
+        foreach (const NickMatcher::Match& match, matches) {
+            const QString user = msg.mid(match.position, match.length);
+            linked += msg.midRef(pos, match.position - pos);
+            linked += link.arg(user, styledText(user, Bold | Color));
+            pos = match.position + match.length;
         }
+        linked += msg.midRef(pos);
+        msg = linked;
     }
     return msg;
 }
 
+LineTemplate MessageFormatter::lineTemplate(const char* source) const
+{
+    // translated and compiled on first use, the templates are the same
+    // for every message and do not depend on the theme, which is styled
+    // through classes
+    QHash<const char*, LineTemplate>::const_iterator it = d.templates.constFind(source);
+    if (it == d.templates.constEnd())
+        it = d.templates.insert(source, LineTemplate(tr(source)));
+    return it.value();
+}
+
+const MessageContext& MessageFormatter::context(IrcMessage* msg) const
+{
+    // worked out once per message by formatMessage() and classifyMessage(),
+    // and dropped again before they return
+    if (d.context.message() != msg)
+        d.context = MessageContext(msg);
+    return d.context;
+}
+
 QString MessageFormatter::formatExpander(const QString& expander) const
 {
-    return tr("<a href='expand:' class='event' style='text-decoration:none;'>%1</a>").arg(expander);
+    return lineTemplate(QT_TR_NOOP("<a href='expand:' class='event' style='text-decoration:none;'>%1</a>")).arg(expander);
 }
 
 QString MessageFormatter::styledText(const QString& text, Style style) const
 {
     QString fmt = text;
     if (style & Bold)
-        fmt = tr("<b>%1</b>").arg(fmt);
+        fmt = lineTemplate(QT_TR_NOOP("<b>%1</b>")).arg(fmt);
     if (style & (Color | Dim)) {
         int bucket = (qHash(text) % 9) + 1;
         if (style & Dim) {
             bucket = 0;
         }
-        fmt = tr("<span class='nick%2'>%1</span>").arg(fmt, QString::number(bucket));
+        fmt = lineTemplate(QT_TR_NOOP("<span class='nick%2'>%1</span>")).arg(fmt, QString::number(bucket));
     }
     return fmt;
 }
@@ -232,11 +332,11 @@ QString MessageFormatter::styledText(const QString& text, Style style) const
 QString MessageFormatter::formatAwayMessage(IrcAwayMessage* msg)
 {
     if (msg->isOwn())
-        return tr("! %1").arg(formatText(msg->content()));
+        return lineTemplate(QT_TR_NOOP("! %1")).arg(formatText(msg->content()));
     else if (!msg->content().isEmpty())
-        return tr("! %1 is away (%2)").arg(formatSender(msg),
+        return lineTemplate(QT_TR_NOOP("! %1 is away (%2)")).arg(formatSender(msg),
                                            formatText(msg->content()));
-    return tr("! %1 is back").arg(formatSender(msg));
+    return lineTemplate(QT_TR_NOOP("! %1 is back")).arg(formatSender(msg));
 }
 
 QString MessageFormatter::formatInviteMessage(IrcInviteMessage* msg)
@@ -252,7 +352,7 @@ QString MessageFormatter::formatInviteMessage(IrcInviteMessage* msg)
 
 QString MessageFormatter::formatJoinMessage(IrcJoinMessage* msg)
 {
-    return tr("%1 %2 joined").arg(formatExpander("!"),
+    return lineTemplate(QT_TR_NOOP("%1 %2 joined")).arg(formatExpander("!"),
                                   formatSender(msg));
 }
 
@@ -291,10 +391,8 @@ QString MessageFormatter::formatNamesMessage(IrcNamesMessage* msg)
     if (msg->flags() & IrcMessage::Implicit)
         return QString();
 
-    if (d.buffer) {
-        IrcUserModel userModel(d.buffer);
-        userModel.setSortMethod(Irc::SortByTitle);
-        QStringList titles = userModel.titles();
+    if (d.index) {
+        const QStringList titles = d.index->model()->titles();
         for (int i = 0; i < titles.count(); i += 10) {
             QStringList row = titles.mid(i, 10);
             MessageData data = formatClass(tr("[NAMES] %1").arg(row.join(tr(" "))), msg);
@@ -307,7 +405,7 @@ QString MessageFormatter::formatNamesMessage(IrcNamesMessage* msg)
 
 QString MessageFormatter::formatNickMessage(IrcNickMessage* msg)
 {
-    return tr("%1 %2 changed nick").arg(formatExpander("!"),
+    return lineTemplate(QT_TR_NOOP("%1 %2 changed nick")).arg(formatExpander("!"),
                                         styledText(msg->newNick(), Bold));
 }
 
@@ -328,16 +426,16 @@ QString MessageFormatter::formatNoticeMessage(IrcNoticeMessage* msg)
         }
     }
 
-    QString pfx = msg->statusPrefix();
+    QString pfx = statusPrefix(msg);
     if (!pfx.isEmpty())
         pfx = styledText(":" + pfx, Dim);
 
-    if (msg->isPrivate())
-        return tr("[%1%2] %3").arg(formatSender(msg),
+    if (isPrivate(msg))
+        return lineTemplate(QT_TR_NOOP("[%1%2] %3")).arg(formatSender(msg),
                                    pfx,
                                    formatText(msg->content()));
 
-    return tr("&lt;%1%2&gt; [%3] %4").arg(formatSender(msg),
+    return lineTemplate(QT_TR_NOOP("&lt;%1%2&gt; [%3] %4")).arg(formatSender(msg),
                                           pfx,
                                           msg->target(),
                                           formatText(msg->content()));
@@ -366,7 +464,7 @@ QString MessageFormatter::formatNumericMessage(IrcNumericMessage* msg)
         return QString();
 
     // if you change this, change formatErrorMessage too
-    if (Irc::codeToString(msg->code()).startsWith("ERR_"))
+    if (context(msg).isError())
         return tr("[ERROR] %1").arg(formatText(MID_(1)));
 
     return tr("[%1] %2").arg(msg->code()).arg(d.textFormat->toHtml(MID_(1)));
@@ -380,7 +478,7 @@ QString MessageFormatter::formatErrorMessage(IrcErrorMessage* msg)
 
 QString MessageFormatter::formatPartMessage(IrcPartMessage* msg)
 {
-    return tr("%1 %2 left").arg(formatExpander("!"),
+    return lineTemplate(QT_TR_NOOP("%1 %2 left")).arg(formatExpander("!"),
                                 formatSender(msg));
 }
 
@@ -398,14 +496,14 @@ QString MessageFormatter::formatPrivateMessage(IrcPrivateMessage* msg)
                                             msg->content().split(" ").value(0).toUpper());
 
     if (msg->isAction())
-        return tr("* %1 %2").arg(formatSender(msg),
+        return lineTemplate(QT_TR_NOOP("* %1 %2")).arg(formatSender(msg),
                                  formatText(msg->content()));
 
-    QString pfx = msg->statusPrefix();
+    QString pfx = statusPrefix(msg);
     if (!pfx.isEmpty())
         pfx = styledText(":" + pfx, Dim);
 
-    return tr("&lt;<a style='text-decoration:none;' href='nick:%1'>%2</a>%3&gt; %4").arg(msg->nick(),
+    return lineTemplate(QT_TR_NOOP("&lt;<a style='text-decoration:none;' href='nick:%1'>%2</a>%3&gt; %4")).arg(msg->nick(),
                                                                                          formatSender(msg),
                                                                                          pfx,
                                                                                          formatText(msg->content()));
@@ -413,14 +511,11 @@ QString MessageFormatter::formatPrivateMessage(IrcPrivateMessage* msg)
 
 QString MessageFormatter::formatQuitMessage(IrcQuitMessage* msg)
 {
-    QString reason = msg->reason();
-    if (reason.contains("Ping timeout")
-            || reason.contains("Connection reset by peer")
-            || reason.contains("Remote host closed the connection")) {
-        return tr("%1 %2 disconnected").arg(formatExpander("!"),
+    if (context(msg).isError()) {
+        return lineTemplate(QT_TR_NOOP("%1 %2 disconnected")).arg(formatExpander("!"),
                                             formatSender(msg));
     }
-    return tr("%1 %2 quit").arg(formatExpander("!"),
+    return lineTemplate(QT_TR_NOOP("%1 %2 quit")).arg(formatExpander("!"),
                                 formatSender(msg));
 }
 
@@ -488,71 +583,22 @@ QString MessageFormatter::formatWhoReplyMessage(IrcWhoReplyMessage* msg)
 
 MessageData MessageFormatter::formatClass(const QString& format, IrcMessage* msg) const
 {
-    MessageData data;
-    data.initFrom(msg);
-
-    QString cls = "message";
-    switch (data.type()) {
-        case IrcMessage::Away:
-        case IrcMessage::Invite:
-        case IrcMessage::Join:
-        case IrcMessage::Kick:
-        case IrcMessage::Mode:
-        case IrcMessage::Motd:
-        case IrcMessage::Names:
-        case IrcMessage::Nick:
-        case IrcMessage::Part:
-        case IrcMessage::Pong:
-        case IrcMessage::Quit:
-        case IrcMessage::Topic:
-        case IrcMessage::Whois:
-        case IrcMessage::Whowas:
-        case IrcMessage::WhoReply:
-            cls = "event";
-            break;
-        case IrcMessage::Unknown:
-            cls = "unknown";
-            break;
-        case IrcMessage::Notice:
-            if (IrcNoticeMessage* m = static_cast<IrcNoticeMessage*>(msg))
-                cls = m->isReply() ? "event" : "notice";
-            break;
-        case IrcMessage::Private:
-            if (IrcPrivateMessage* m = static_cast<IrcPrivateMessage*>(msg))
-                cls = m->isAction() ? "action" : m->isRequest() ? "event" : "message";
-            break;
-        case IrcMessage::Numeric:
-            if (IrcNumericMessage* m = static_cast<IrcNumericMessage*>(msg))
-                cls = Irc::codeToString(m->code()).startsWith("ERR_") ? "notice" : "event";
-            break;
-        case IrcMessage::Error:
-            cls = "notice";
-            break;
-        default:
-            break;
-    }
+    const MessageContext& ctx = context(msg);
 
+    MessageData data;
+    data.initFrom(msg, ctx);
     if (!format.isEmpty())
-        data.setFormat(tr("<span class='%1'>%2</span>").arg(cls, format));
+        data.setFormat(lineTemplate(QT_TR_NOOP("<span class='%1'>%2</span>")).arg(ctx.styleClass(), format));
     return data;
 }
 
 QString MessageFormatter::formatSender(IrcMessage* msg) const
 {
     Style style = Bold;
-    if (MessageData::effectiveType(msg) == IrcMessage::Private) {
+    if (context(msg).type() == IrcMessage::Private) {
         IrcPrivateMessage* p = static_cast<IrcPrivateMessage*>(msg);
         if (!p->isAction() && !p->isRequest())
             style |= msg->isOwn() ? Dim : Color;
     }
     return styledText(msg->nick(), style);
 }
-
-void MessageFormatter::indexNames(const QStringList& names)
-{
-    d.names.clear();
-    foreach (const QString& name, names) {
-        if (!name.isEmpty())
-            d.names.insert(name.at(0), name);
-    }
-}
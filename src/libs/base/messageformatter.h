@@ -36,9 +36,12 @@
 #include <IrcGlobal>
 #include <IrcMessage>
 #include "messagedata.h"
+#include "nickmatcher.h"
+#include "messagecontext.h"
+#include "linetemplate.h"
 
 class IrcBuffer;
-class IrcUserModel;
+class UserIndex;
 class IrcTextFormat;
 
 class MessageFormatter : public QObject
@@ -49,6 +52,7 @@ class MessageFormatter : public QObject
 
 public:
     explicit MessageFormatter(QObject* parent = 0);
+    ~MessageFormatter();
 
     IrcBuffer* buffer() const;
     void setBuffer(IrcBuffer* buffer);
@@ -56,7 +60,14 @@ public:
     IrcTextFormat* textFormat() const;
     void setTextFormat(IrcTextFormat* format);
 
+    NickMatcher names() const;
+    void setNames(const NickMatcher& names);
+
+    bool isPlain() const;
+    void setPlain(bool plain);
+
     MessageData formatMessage(IrcMessage* msg);
+    MessageData classifyMessage(IrcMessage* msg) const;
     QString formatText(const QString& text) const;
 
     enum StyleFlag
@@ -99,15 +110,18 @@ protected:
     virtual QString formatSender(IrcMessage* msg) const;
     virtual QString formatExpander(const QString& expander) const;
 
-private slots:
-    void indexNames(const QStringList& names);
-
 private:
+    const MessageContext& context(IrcMessage* msg) const;
+    LineTemplate lineTemplate(const char* source) const;
+
     struct Private {
+        bool plain;
         IrcBuffer* buffer;
-        IrcUserModel* userModel;
+        UserIndex* index;
+        NickMatcher names;
         IrcTextFormat* textFormat;
-        QMultiHash<QChar, QString> names;
+        mutable MessageContext context;
+        mutable QHash<const char*, LineTemplate> templates;
     } d;
 };
 
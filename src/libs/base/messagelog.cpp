@@ -0,0 +1,199 @@
+/*
+  Copyright (C) 2008-2015 The Communi Project
+
+  You may use this file under the terms of BSD license as follows:
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "messagelog.h"
+#include <QDesktopServices>
+#include <QTimerEvent>
+#include <QFileInfo>
+#include <QUrl>
+#include <QDir>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static const qint64 SegmentSize = 1024 * 1024;
+static const int SegmentCount = 8;
+static const int SyncInterval = 5000;
+
+MessageLog::MessageLog(const QString& id, QObject* parent) : QObject(parent)
+{
+    d.id = id;
+    d.timer = 0;
+    d.segment = 0;
+    d.size = 0;
+
+    // <data>/logs/<connection uuid>/<buffer title>
+    const QString uuid = id.section('/', 0, 0);
+    const QString title = id.section('/', 1);
+    QDir dir(QDesktopServices::storageLocation(QDesktopServices::DataLocation));
+    d.path = dir.filePath(QString("logs/%1/%2").arg(uuid, QString::fromLatin1(QUrl::toPercentEncoding(title))));
+}
+
+MessageLog::~MessageLog()
+{
+    sync();
+}
+
+QString MessageLog::id() const
+{
+    return d.id;
+}
+
+QString MessageLog::path() const
+{
+    return d.path;
+}
+
+QList<MessageLog::Entry> MessageLog::tail(int count) const
+{
+    QList<Entry> entries;
+    QDir dir(d.path);
+    QStringList files = segments();
+    while (entries.count() < count && !files.isEmpty()) {
+        QFile file(dir.filePath(files.takeLast()));
+        if (!file.open(QIODevice::ReadOnly) || file.size() <= 0)
+            continue;
+
+        // map the segment and walk it backwards, so only the
+        // pages holding the requested tail are actually read in
+        const qint64 size = file.size();
+        const char* data = reinterpret_cast<const char*>(file.map(0, size));
+        if (!data)
+            continue;
+
+        QList<Entry> lines;
+        qint64 end = size;
+        // a crash may leave a partial line behind
+        while (end > 0 && data[end - 1] != '\n')
+            --end;
+        while (end > 0 && entries.count() + lines.count() < count) {
+            qint64 start = end - 1;
+            while (start > 0 && data[start - 1] != '\n')
+                --start;
+            const QByteArray line = QByteArray::fromRawData(data + start, end - start - 1);
+            const int sep = line.indexOf(' ');
+            if (sep > 0) {
+                Entry entry;
+                entry.timestamp = QDateTime::fromMSecsSinceEpoch(line.left(sep).toLongLong());
+                entry.data = line.mid(sep + 1);
+                lines.prepend(entry);
+            }
+            end = start;
+        }
+        file.unmap(reinterpret_cast<uchar*>(const_cast<char*>(data)));
+        entries = lines + entries;
+    }
+    return entries;
+}
+
+void MessageLog::write(const QDateTime& timestamp, const QByteArray& data)
+{
+    if (data.isEmpty() || data.contains('\n') || (!d.file.isOpen() && !open()))
+        return;
+
+    QByteArray line = QByteArray::number(timestamp.toMSecsSinceEpoch());
+    line += ' ';
+    line += data;
+    line += '\n';
+    // asking the file for its size would flush it every time
+    d.size += d.file.write(line);
+
+    if (d.size >= SegmentSize)
+        rotate();
+    else if (!d.timer)
+        d.timer = startTimer(SyncInterval);
+}
+
+void MessageLog::sync()
+{
+    if (d.timer) {
+        killTimer(d.timer);
+        d.timer = 0;
+    }
+    if (d.file.isOpen() && d.file.flush()) {
+#ifdef Q_OS_WIN
+        _commit(d.file.handle());
+#else
+        fsync(d.file.handle());
+#endif
+    }
+}
+
+void MessageLog::timerEvent(QTimerEvent* event)
+{
+    if (event->timerId() == d.timer)
+        sync();
+    else
+        QObject::timerEvent(event);
+}
+
+bool MessageLog::open()
+{
+    QDir dir(d.path);
+    if (!dir.exists() && !dir.mkpath("."))
+        return false;
+
+    const QStringList files = segments();
+    if (!files.isEmpty()) {
+        d.segment = QFileInfo(files.last()).baseName().toInt();
+        if (QFileInfo(dir.filePath(files.last())).size() >= SegmentSize)
+            ++d.segment;
+    }
+
+    d.file.setFileName(dir.filePath(QString("%1.log").arg(d.segment, 8, 10, QChar('0'))));
+    if (!d.file.open(QIODevice::ReadWrite | QIODevice::Append))
+        return false;
+
+    // terminate a partial line left behind by a crash
+    d.size = d.file.size();
+    char last = '\n';
+    if (d.size > 0 && d.file.seek(d.size - 1) && d.file.getChar(&last) && last != '\n')
+        d.size += d.file.write("\n");
+    return true;
+}
+
+void MessageLog::rotate()
+{
+    sync();
+    d.file.close();
+
+    ++d.segment;
+    QDir dir(d.path);
+    QStringList files = segments();
+    while (files.count() >= SegmentCount)
+        dir.remove(files.takeFirst());
+}
+
+QStringList MessageLog::segments() const
+{
+    // zero padded sequence numbers sort chronologically by name
+    return QDir(d.path).entryList(QStringList("*.log"), QDir::Files, QDir::Name);
+}
@@ -0,0 +1,79 @@
+/*
+  Copyright (C) 2008-2015 The Communi Project
+
+  You may use this file under the terms of BSD license as follows:
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MESSAGELOG_H
+#define MESSAGELOG_H
+
+#include <QList>
+#include <QFile>
+#include <QObject>
+#include <QDateTime>
+#include <QByteArray>
+#include <QStringList>
+
+class MessageLog : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit MessageLog(const QString& id, QObject* parent = 0);
+    ~MessageLog();
+
+    QString id() const;
+    QString path() const;
+
+    struct Entry {
+        QDateTime timestamp;
+        QByteArray data;
+    };
+
+    QList<Entry> tail(int count) const;
+
+public slots:
+    void write(const QDateTime& timestamp, const QByteArray& data);
+    void sync();
+
+protected:
+    void timerEvent(QTimerEvent* event);
+
+private:
+    bool open();
+    void rotate();
+    QStringList segments() const;
+
+    struct Private {
+        int timer;
+        int segment;
+        qint64 size;
+        QString id;
+        QString path;
+        QFile file;
+    } d;
+};
+
+#endif // MESSAGELOG_H
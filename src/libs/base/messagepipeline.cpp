@@ -0,0 +1,261 @@
+/*
+  Copyright (C) 2008-2015 The Communi Project
+
+  You may use this file under the terms of BSD license as follows:
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "messagepipeline.h"
+#include "messageformatter.h"
+#include "nickmatcher.h"
+#include <IrcTextFormat>
+#include <QThreadStorage>
+#include <IrcConnection>
+#include <IrcMessage>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QMutex>
+
+// the most lines delivered per event loop iteration
+static const int DeliverySize = 256;
+
+struct MessagePipelineItem
+{
+    bool plain;
+    bool format;
+    bool received;
+    int generation;
+    MessageData data;
+    IrcMessage::Flags flags;
+    QByteArray encoding;
+    QVariant priv;
+    QString prefix;
+    NickMatcher names;
+};
+
+struct MessagePipelineState
+{
+    QMutex mutex;
+    bool closed;
+    bool posted;
+    bool running;
+    int generation;
+    QObject* receiver;
+    QString urlPattern;
+    IrcTextFormat::SpanFormat spanFormat;
+    QList<MessagePipelineItem> input;
+    QList<MessagePipelineItem> output;
+};
+
+class MessagePipelineJob : public QRunnable
+{
+public:
+    MessagePipelineJob(const QSharedPointer<MessagePipelineState>& state) : state(state) { }
+
+    void run()
+    {
+        // each worker thread keeps a formatter of its own, which only
+        // ever sees snapshots of the buffer and its connection
+        static QThreadStorage<MessageFormatter*> formatters;
+        if (!formatters.hasLocalData())
+            formatters.setLocalData(new MessageFormatter);
+        MessageFormatter& formatter = *formatters.localData();
+        {
+            QMutexLocker locker(&state->mutex);
+            formatter.textFormat()->setUrlPattern(state->urlPattern);
+            formatter.textFormat()->setSpanFormat(state->spanFormat);
+        }
+
+        forever {
+            MessagePipelineItem item;
+            {
+                QMutexLocker locker(&state->mutex);
+                if (state->closed || state->input.isEmpty()) {
+                    state->running = false;
+                    return;
+                }
+                item = state->input.takeFirst();
+            }
+
+            if (item.format) {
+                IrcMessage* msg = item.data.toMessage();
+                if (msg) {
+                    msg->setEncoding(item.encoding);
+                    msg->setFlags(item.flags);
+                    msg->setProperty("private", item.priv);
+                    msg->setProperty("statusPrefix", item.prefix);
+                    formatter.setPlain(item.plain);
+                    formatter.setNames(item.names);
+                    item.data.setFormat(formatter.formatMessage(msg).format());
+                    delete msg;
+                }
+                item.data.setDeferred(false);
+            }
+
+            // lines formatted for a buffer that has been cleared since
+            QMutexLocker locker(&state->mutex);
+            if (item.generation != state->generation)
+                continue;
+            state->output += item;
+            if (!state->posted && !state->closed) {
+                state->posted = true;
+                QMetaObject::invokeMethod(state->receiver, "deliver", Qt::QueuedConnection);
+            }
+        }
+    }
+
+private:
+    QSharedPointer<MessagePipelineState> state;
+};
+
+MessagePipeline::MessagePipeline(MessageFormatter* formatter, QObject* parent) : QObject(parent)
+{
+    d.snapshot = false;
+    d.formatter = formatter;
+    d.state = QSharedPointer<MessagePipelineState>(new MessagePipelineState);
+    d.state->closed = false;
+    d.state->posted = false;
+    d.state->running = false;
+    d.state->generation = 0;
+    d.state->receiver = this;
+    d.state->spanFormat = IrcTextFormat::SpanClass;
+}
+
+MessagePipeline::~MessagePipeline()
+{
+    // a job that is still running holds on to the state,
+    // and finishes without posting anything back
+    QMutexLocker locker(&d.state->mutex);
+    d.state->closed = true;
+    d.state->input.clear();
+    d.state->output.clear();
+}
+
+bool MessagePipeline::isIdle() const
+{
+    QMutexLocker locker(&d.state->mutex);
+    return !d.state->running && d.state->input.isEmpty() && d.state->output.isEmpty();
+}
+
+void MessagePipeline::enqueue(IrcMessage* message, const MessageData& data)
+{
+    // whatever the formatter would ask the connection for is
+    // captured here, the copy in the worker has no connection
+    MessagePipelineItem item;
+    item.format = true;
+    item.received = true;
+    item.data = data;
+    item.flags = message->flags();
+    if (IrcConnection* connection = message->connection())
+        item.encoding = connection->encoding();
+    else
+        item.encoding = message->encoding();
+    if (message->type() == IrcMessage::Private) {
+        IrcPrivateMessage* pm = static_cast<IrcPrivateMessage*>(message);
+        item.priv = pm->isPrivate();
+        item.prefix = pm->statusPrefix();
+    } else if (message->type() == IrcMessage::Notice) {
+        IrcNoticeMessage* nm = static_cast<IrcNoticeMessage*>(message);
+        item.priv = nm->isPrivate();
+        item.prefix = nm->statusPrefix();
+    }
+    item.plain = d.formatter->isPlain();
+    if (!item.plain) {
+        // the names are compiled and copied once per pass of the event
+        // loop, however many lines a netjoin or a names burst enqueues
+        if (!d.snapshot) {
+            d.snapshot = true;
+            d.names = d.formatter->names();
+            QMetaObject::invokeMethod(this, "expireNames", Qt::QueuedConnection);
+        }
+        item.names = d.names;
+    }
+
+    QMutexLocker locker(&d.state->mutex);
+    item.generation = d.state->generation;
+    d.state->urlPattern = d.formatter->textFormat()->urlPattern();
+    d.state->spanFormat = d.formatter->textFormat()->spanFormat();
+    d.state->input += item;
+    start();
+}
+
+void MessagePipeline::enqueue(const MessageData& data, bool received)
+{
+    // already formatted, passes through to keep its place in line
+    MessagePipelineItem item;
+    item.plain = false;
+    item.format = false;
+    item.received = received;
+    item.data = data;
+
+    QMutexLocker locker(&d.state->mutex);
+    item.generation = d.state->generation;
+    d.state->input += item;
+    start();
+}
+
+void MessagePipeline::clear()
+{
+    // whatever a running job is in the middle of is dropped
+    QMutexLocker locker(&d.state->mutex);
+    ++d.state->generation;
+    d.state->input.clear();
+    d.state->output.clear();
+}
+
+void MessagePipeline::deliver()
+{
+    QList<MessagePipelineItem> items;
+    {
+        QMutexLocker locker(&d.state->mutex);
+        items = d.state->output.mid(0, DeliverySize);
+        d.state->output = d.state->output.mid(items.count());
+        d.state->posted = !d.state->output.isEmpty();
+        if (d.state->posted)
+            QMetaObject::invokeMethod(this, "deliver", Qt::QueuedConnection);
+    }
+
+    foreach (const MessagePipelineItem& item, items)
+        emit formatted(item.data, item.received);
+    if (!items.isEmpty())
+        emit delivered();
+}
+
+void MessagePipeline::expireNames()
+{
+    // let go of the copy, so that the next change to
+    // the user list does not have to detach from it
+    d.snapshot = false;
+    d.names = NickMatcher();
+}
+
+void MessagePipeline::start()
+{
+    // one job per buffer at a time keeps the lines in order,
+    // while different buffers get formatted in parallel
+    if (!d.state->running) {
+        d.state->running = true;
+        QThreadPool::globalInstance()->start(new MessagePipelineJob(d.state));
+    }
+}
@@ -0,0 +1,129 @@
+/*
+  Copyright (C) 2008-2015 The Communi Project
+
+  You may use this file under the terms of BSD license as follows:
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "messagering.h"
+
+MessageRing::MessageRing(int capacity)
+{
+    d.head = 0;
+    d.capacity = qMax(0, capacity);
+}
+
+int MessageRing::capacity() const
+{
+    return d.capacity;
+}
+
+void MessageRing::setCapacity(int capacity)
+{
+    capacity = qMax(0, capacity);
+    if (d.capacity != capacity) {
+        linearize();
+        if (capacity > 0 && d.lines.count() > capacity)
+            d.lines.remove(0, d.lines.count() - capacity);
+        d.capacity = capacity;
+    }
+}
+
+int MessageRing::count() const
+{
+    return d.lines.count();
+}
+
+bool MessageRing::isEmpty() const
+{
+    return d.lines.isEmpty();
+}
+
+const MessageData& MessageRing::at(int index) const
+{
+    Q_ASSERT(index >= 0 && index < d.lines.count());
+    return d.lines.at((d.head + index) % d.lines.count());
+}
+
+const MessageData& MessageRing::last() const
+{
+    return at(d.lines.count() - 1);
+}
+
+int MessageRing::append(const MessageData& data)
+{
+    // grow until the capacity is reached, and only then
+    // start overwriting the oldest line in place
+    if (d.capacity <= 0 || d.lines.count() < d.capacity) {
+        linearize();
+        d.lines.append(data);
+        return 0;
+    }
+    d.lines[d.head] = data;
+    d.head = (d.head + 1) % d.lines.count();
+    return 1;
+}
+
+int MessageRing::prepend(const QVector<MessageData>& lines)
+{
+    // fills up whatever room is left in front of the existing lines,
+    // keeping the most recent of the given ones
+    linearize();
+    int count = lines.count();
+    if (d.capacity > 0)
+        count = qMin(count, d.capacity - d.lines.count());
+    if (count > 0)
+        d.lines = lines.mid(lines.count() - count) + d.lines;
+    return qMax(0, count);
+}
+
+void MessageRing::replace(int index, const MessageData& data)
+{
+    Q_ASSERT(index >= 0 && index < d.lines.count());
+    d.lines[(d.head + index) % d.lines.count()] = data;
+}
+
+void MessageRing::replaceLast(const MessageData& data)
+{
+    Q_ASSERT(!d.lines.isEmpty());
+    replace(d.lines.count() - 1, data);
+}
+
+void MessageRing::clear()
+{
+    d.head = 0;
+    d.lines.clear();
+}
+
+void MessageRing::linearize()
+{
+    if (d.head > 0) {
+        QVector<MessageData> lines;
+        lines.reserve(d.lines.count());
+        for (int i = 0; i < d.lines.count(); ++i)
+            lines += at(i);
+        d.lines = lines;
+        d.head = 0;
+    }
+}
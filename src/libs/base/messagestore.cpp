@@ -0,0 +1,515 @@
+/*
+  Copyright (C) 2008-2015 The Communi Project
+
+  You may use this file under the terms of BSD license as follows:
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "messagestore.h"
+#include "messagedispatcher.h"
+#include "messagepipeline.h"
+#include "eventaggregate.h"
+#include "eventformatter.h"
+#include "messagelog.h"
+#include <IrcConnection>
+#include <IrcMessage>
+#include <IrcBuffer>
+#include <QTimer>
+
+static const int MaxSplits = 10000;
+
+// the incoming rate is measured over windows of a second
+static const int RateWindow = 1000;
+
+static MessageData dateLine(const QDate& date)
+{
+    MessageData dc;
+    dc.setFormat(QString("<p class='date'>%1</p>").arg(date.toString(Qt::ISODate)));
+    return dc;
+}
+
+static bool isMultiLine(IrcMessage::Type type)
+{
+    return type == IrcMessage::Motd || type == IrcMessage::Names
+            || type == IrcMessage::Whois || type == IrcMessage::Whowas;
+}
+
+MessageStore::MessageStore(IrcBuffer* buffer) : QObject(buffer)
+{
+    d.lazy = false;
+    d.batch = false;
+    d.replay = false;
+    d.threaded = false;
+    d.expected = false;
+    d.viewers = 0;
+    d.firehose = false;
+    d.threshold = 0;
+    d.received = 0;
+    d.window.start();
+    d.log = 0;
+    d.pipeline = 0;
+    d.buffer = buffer;
+    d.lines.setCapacity(1000);
+
+    d.meter = new QTimer(this);
+    d.meter->setInterval(RateWindow);
+    connect(d.meter, SIGNAL(timeout()), this, SLOT(updateRate()));
+
+    d.formatter = new MessageFormatter(this);
+    connect(d.formatter, SIGNAL(formatted(MessageData)), this, SLOT(onFormatted(MessageData)));
+    d.formatter->setBuffer(buffer);
+
+    connect(buffer, SIGNAL(messageReceived(IrcMessage*)), this, SLOT(receiveMessage(IrcMessage*)));
+}
+
+MessageStore* MessageStore::instance(IrcBuffer* buffer)
+{
+    MessageStore* store = buffer->findChild<MessageStore*>(QString(), Qt::FindDirectChildrenOnly);
+    if (!store)
+        store = new MessageStore(buffer);
+    return store;
+}
+
+IrcBuffer* MessageStore::buffer() const
+{
+    return d.buffer;
+}
+
+MessageFormatter* MessageStore::formatter() const
+{
+    return d.formatter;
+}
+
+MessageLog* MessageStore::log() const
+{
+    return d.log;
+}
+
+void MessageStore::setLog(MessageLog* log)
+{
+    if (d.log != log) {
+        d.log = log;
+        // the history is read once the buffer is about to be shown
+        d.replay = log && isEmpty();
+        if (d.replay && isWatched())
+            replay();
+    }
+}
+
+int MessageStore::capacity() const
+{
+    return d.lines.capacity();
+}
+
+void MessageStore::setCapacity(int capacity)
+{
+    d.lines.setCapacity(capacity);
+}
+
+int MessageStore::count() const
+{
+    return d.lines.count();
+}
+
+bool MessageStore::isEmpty() const
+{
+    return d.lines.isEmpty();
+}
+
+bool MessageStore::isBatch() const
+{
+    return d.batch;
+}
+
+bool MessageStore::isLazy() const
+{
+    return d.lazy;
+}
+
+void MessageStore::setLazy(bool lazy)
+{
+    d.lazy = lazy;
+}
+
+bool MessageStore::isThreaded() const
+{
+    return d.threaded;
+}
+
+void MessageStore::setThreaded(bool threaded)
+{
+    // the pipeline outlives threaded mode until it has
+    // delivered whatever was queued, to keep lines in order
+    if (threaded && !d.pipeline) {
+        d.pipeline = new MessagePipeline(d.formatter, this);
+        connect(d.pipeline, SIGNAL(formatted(MessageData,bool)), this, SLOT(onPipelineFormatted(MessageData,bool)));
+        connect(d.pipeline, SIGNAL(delivered()), this, SLOT(onPipelineDelivered()));
+    }
+    d.threaded = threaded;
+}
+
+bool MessageStore::isWatched() const
+{
+    // shown in a view, or likely to be shown next
+    return d.viewers > 0 || d.expected;
+}
+
+void MessageStore::setExpected(bool expected)
+{
+    d.expected = expected;
+    if (expected && d.replay)
+        replay();
+}
+
+void MessageStore::addViewer()
+{
+    ++d.viewers;
+    if (d.replay)
+        replay();
+}
+
+void MessageStore::removeViewer()
+{
+    d.viewers = qMax(0, d.viewers - 1);
+}
+
+bool MessageStore::isFirehose() const
+{
+    return d.firehose;
+}
+
+int MessageStore::firehoseThreshold() const
+{
+    return d.threshold;
+}
+
+void MessageStore::setFirehoseThreshold(int rate)
+{
+    // lines per second, 0 disables firehose mode
+    d.threshold = rate;
+    if (rate <= 0)
+        setFirehose(false);
+}
+
+void MessageStore::setFirehose(bool firehose)
+{
+    // the formatter drops colors, links and nicks, events are no
+    // longer merged and documents insert in batches. the meter keeps
+    // running without incoming lines, to notice the flood is over.
+    if (d.firehose != firehose) {
+        d.firehose = firehose;
+        d.formatter->setPlain(firehose);
+        if (firehose)
+            d.meter->start();
+        else
+            d.meter->stop();
+        emit firehoseChanged(firehose);
+    }
+}
+
+void MessageStore::updateRate()
+{
+    const qint64 elapsed = d.window.restart();
+    const int rate = elapsed > 0 ? d.received * 1000 / elapsed : 0;
+    d.received = 0;
+
+    // half the threshold to get out, not to flip back and forth
+    if (!d.firehose && d.threshold > 0 && rate >= d.threshold)
+        setFirehose(true);
+    else if (d.firehose && rate < d.threshold / 2)
+        setFirehose(false);
+}
+
+const MessageData& MessageStore::at(int index) const
+{
+    return d.lines.at(index);
+}
+
+const MessageData& MessageStore::last() const
+{
+    return d.lines.last();
+}
+
+const MessageData& MessageStore::format(int index)
+{
+    const MessageData& line = d.lines.at(index);
+    if (line.isDeferred()) {
+        // the line keeps what it was classified as, only the
+        // rich text is filled in from the original message
+        MessageData data = line;
+        IrcMessage* msg = data.toMessage(d.buffer->connection());
+        if (msg) {
+            data.setFormat(d.formatter->formatMessage(msg).format());
+            delete msg;
+        }
+        data.setDeferred(false);
+        d.lines.replace(index, data);
+    }
+    return d.lines.at(index);
+}
+
+void MessageStore::clear()
+{
+    if (d.pipeline)
+        d.pipeline->clear();
+    d.lines.clear();
+    d.splits.clear();
+    d.events.clear();
+    emit cleared();
+}
+
+void MessageStore::append(const MessageData& data)
+{
+    if (!data.isEmpty()) {
+        MessageData last;
+        if (!d.lines.isEmpty())
+            last = d.lines.last();
+
+        if (!last.isEmpty() && data.type() != IrcMessage::Unknown && data.timestamp().date() != last.timestamp().date())
+            append(dateLine(data.timestamp().date()));
+
+        // users returning after a netsplit show up as rejoining
+        MessageData msg = data;
+        if (msg.type() == IrcMessage::Quit && !msg.split().isEmpty()) {
+            // whoever has not returned by the time the table fills up
+            // is not part of a netjoin anymore
+            if (d.splits.count() >= MaxSplits)
+                d.splits.clear();
+            d.splits.insert(msg.nick(), msg.split());
+        }
+        else if (msg.type() == IrcMessage::Join && !d.splits.isEmpty())
+            msg.setSplit(d.splits.take(msg.nick()));
+
+        if (!d.firehose && last.canMerge(msg)) {
+            // the same event may be dispatched to several buffers, each
+            // store sums it up in an aggregate of its own and appends to
+            // that one for as long as it belongs to the last line
+            if (!d.events || last.aggregate() != d.events) {
+                d.events = QSharedPointer<EventAggregate>(new EventAggregate);
+                foreach (const MessageData& event, last.getEvents())
+                    d.events->add(event);
+            }
+            d.events->add(msg);
+            msg.setAggregate(d.events);
+            msg.setFormat(formatSummary(*d.events));
+            d.lines.replaceLast(msg);
+            emit lineMerged();
+        } else {
+            const int dropped = d.lines.append(msg);
+            emit lineAppended(dropped);
+        }
+    }
+}
+
+void MessageStore::receiveMessage(IrcMessage* message)
+{
+    if (message->type() == IrcMessage::Batch) {
+        IrcBatchMessage* batch = static_cast<IrcBatchMessage*>(message);
+        d.batch = true;
+        foreach (IrcMessage* msg, batch->messages())
+            receiveMessage(msg);
+        d.batch = false;
+        emit batchFinished();
+    } else {
+        if (d.threshold > 0) {
+            ++d.received;
+            if (d.window.elapsed() >= RateWindow)
+                updateRate();
+        }
+
+        // multi-line replies are formatted into one batch, so
+        // that documents lay them out in a single edit block
+        const bool replies = !d.batch && isMultiLine(MessageData::effectiveType(message));
+        if (replies)
+            d.batch = true;
+
+        MessageData data;
+        if (MessageDispatcher* dispatcher = MessageDispatcher::instance(d.buffer->connection()))
+            data = dispatcher->dispatch(message);
+        if (data.isEmpty())
+            data = classify(message);
+        if (!data.isEmpty()) {
+            if (d.log)
+                d.log->write(data.timestamp(), data.data());
+            // lines nobody is about to look at stay deferred
+            if (d.pipeline && d.threaded && data.isDeferred() && isWatched()) {
+                d.pipeline->enqueue(message, data);
+            } else if (d.pipeline && !d.pipeline->isIdle()) {
+                d.pipeline->enqueue(data, true);
+            } else {
+                append(data);
+                emit messageReceived(message, data);
+            }
+        }
+
+        if (replies) {
+            d.batch = false;
+            emit batchFinished();
+        }
+    }
+}
+
+void MessageStore::replay()
+{
+    // restore history straight from the log, bypassing the buffer so
+    // nothing gets highlighted or written back. lines that arrived while
+    // the buffer was not shown yet are already there, and the history
+    // goes in front of them, into whatever room the ring has left.
+    d.replay = false;
+    const int room = capacity() - count();
+    if (!d.log || room <= 0)
+        return;
+
+    MessageRing lines(capacity());
+    qSwap(lines, d.lines);
+    const bool blocked = blockSignals(true);
+    d.batch = true;
+    IrcConnection* connection = d.buffer->connection();
+    foreach (const MessageLog::Entry& entry, d.log->tail(room)) {
+        IrcMessage* msg = MessageData::parseMessage(entry.data, entry.timestamp, connection);
+        if (msg) {
+            append(classify(msg));
+            delete msg;
+        }
+    }
+    d.batch = false;
+    blockSignals(blocked);
+    qSwap(lines, d.lines);
+
+    QVector<MessageData> history;
+    for (int i = 0; i < lines.count(); ++i)
+        history += lines.at(i);
+    if (!history.isEmpty() && !isEmpty()) {
+        const MessageData& first = d.lines.at(0);
+        if (first.type() != IrcMessage::Unknown && first.timestamp().date() != history.last().timestamp().date())
+            history += dateLine(first.timestamp().date());
+    }
+
+    const int prepended = d.lines.prepend(history);
+    if (prepended > 0)
+        emit linesPrepended(prepended);
+}
+
+MessageData MessageStore::classify(IrcMessage* message)
+{
+    // in lazy mode the formatting of ordinary lines is
+    // deferred until a document actually lays them out,
+    // in threaded mode it is handed over to the pipeline
+    if (d.lazy || d.threaded) {
+        MessageData data = d.formatter->classifyMessage(message);
+        if (data.isDeferred())
+            return data;
+    }
+    return d.formatter->formatMessage(message);
+}
+
+void MessageStore::onFormatted(const MessageData& data)
+{
+    // multi-line replies queue up behind pending lines
+    if (d.pipeline && !d.pipeline->isIdle())
+        d.pipeline->enqueue(data, false);
+    else
+        append(data);
+}
+
+void MessageStore::onPipelineFormatted(const MessageData& data, bool received)
+{
+    // lines arrive in batches, the original message is
+    // long gone so listeners get an equivalent copy
+    if (data.isEmpty())
+        return;
+    d.batch = true;
+    append(data);
+    if (received) {
+        IrcMessage* msg = data.toMessage(d.buffer->connection());
+        if (msg) {
+            emit messageReceived(msg, data);
+            delete msg;
+        }
+    }
+}
+
+void MessageStore::onPipelineDelivered()
+{
+    d.batch = false;
+    emit batchFinished();
+}
+
+QString MessageStore::formatSummary(const EventAggregate& events) const
+{
+    QStringList actions;
+    QStringList changes;
+    EventFormatter formatter;
+
+    foreach (EventAggregate::Action action, events.actions()) {
+        switch (action) {
+        case EventAggregate::Joined:
+            actions += tr("joined");
+            break;
+        case EventAggregate::Left:
+            actions += tr("left");
+            break;
+        case EventAggregate::Quit:
+            actions += tr("quit");
+            break;
+        case EventAggregate::Split:
+            actions += tr("split (%1)").arg(events.servers());
+            break;
+        case EventAggregate::Rejoined:
+            actions += tr("rejoined");
+            break;
+        case EventAggregate::Disconnected:
+            actions += tr("disconnected");
+            break;
+        case EventAggregate::Kicked:
+            actions += tr("kicked");
+            break;
+        case EventAggregate::ChangedNick:
+            changes += tr("nick");
+            break;
+        case EventAggregate::ChangedMode:
+            changes += tr("mode");
+            break;
+        case EventAggregate::ChangedTopic:
+            changes += tr("topic");
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (!changes.isEmpty())
+        actions += tr("changed %1").arg(changes.join(tr(" and ")));
+
+    if (actions.count() > 2)
+        actions = QStringList() << QStringList(actions.mid(0, actions.count() - 1)).join(tr(", ")) << actions.last();
+
+    const QStringList nicks = events.nicks();
+    if (nicks.count() == 1)
+        return formatter.formatEvent(tr("%1 %2").arg(formatter.styledText(nicks.first(), MessageFormatter::Bold),
+                                                     actions.join(tr(" and "))));
+
+    return formatter.formatEvent(tr("%1 %2").arg(formatter.styledText(tr("%1 users").arg(nicks.count()), MessageFormatter::Bold),
+                                                 actions.join(tr(" or "))));
+}
@@ -0,0 +1,136 @@
+/*
+  Copyright (C) 2008-2015 The Communi Project
+
+  You may use this file under the terms of BSD license as follows:
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MESSAGESTORE_H
+#define MESSAGESTORE_H
+
+#include <QHash>
+#include <QObject>
+#include <QElapsedTimer>
+#include "messagedata.h"
+#include "messagering.h"
+
+class QTimer;
+class IrcBuffer;
+class IrcMessage;
+class MessageLog;
+class EventAggregate;
+class MessagePipeline;
+class MessageFormatter;
+
+class MessageStore : public QObject
+{
+    Q_OBJECT
+
+public:
+    static MessageStore* instance(IrcBuffer* buffer);
+
+    IrcBuffer* buffer() const;
+    MessageFormatter* formatter() const;
+
+    MessageLog* log() const;
+    void setLog(MessageLog* log);
+
+    int capacity() const;
+    void setCapacity(int capacity);
+
+    int count() const;
+    bool isEmpty() const;
+    bool isBatch() const;
+
+    bool isLazy() const;
+    void setLazy(bool lazy);
+
+    bool isThreaded() const;
+    void setThreaded(bool threaded);
+
+    bool isWatched() const;
+    void setExpected(bool expected);
+    void addViewer();
+    void removeViewer();
+
+    bool isFirehose() const;
+    int firehoseThreshold() const;
+    void setFirehoseThreshold(int rate);
+
+    const MessageData& at(int index) const;
+    const MessageData& last() const;
+
+    const MessageData& format(int index);
+
+public slots:
+    void clear();
+    void append(const MessageData& data);
+    void receiveMessage(IrcMessage* message);
+
+signals:
+    void cleared();
+    void lineAppended(int dropped);
+    void linesPrepended(int count);
+    void lineMerged();
+    void batchFinished();
+    void firehoseChanged(bool firehose);
+    void messageReceived(IrcMessage* message, const MessageData& data);
+
+private slots:
+    void onFormatted(const MessageData& data);
+    void onPipelineFormatted(const MessageData& data, bool received);
+    void onPipelineDelivered();
+    void updateRate();
+
+private:
+    explicit MessageStore(IrcBuffer* buffer);
+
+    void replay();
+    void setFirehose(bool firehose);
+    MessageData classify(IrcMessage* message);
+    QString formatSummary(const EventAggregate& events) const;
+
+    struct Private {
+        bool lazy;
+        bool batch;
+        bool replay;
+        bool threaded;
+        bool expected;
+        int viewers;
+        bool firehose;
+        int threshold;
+        int received;
+        QTimer* meter;
+        QElapsedTimer window;
+        IrcBuffer* buffer;
+        MessageLog* log;
+        MessageRing lines;
+        QHash<QString, QString> splits;
+        QSharedPointer<EventAggregate> events;
+        MessagePipeline* pipeline;
+        MessageFormatter* formatter;
+    } d;
+};
+
+#endif // MESSAGESTORE_H
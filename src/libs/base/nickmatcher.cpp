@@ -0,0 +1,274 @@
+/*
+  Copyright (C) 2008-2015 The Communi Project
+
+  You may use this file under the terms of BSD license as follows:
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "nickmatcher.h"
+#include <QTextBoundaryFinder>
+#include <QtAlgorithms>
+
+static inline quint64 edgeKey(int node, QChar c)
+{
+    return (quint64(node) << 16) | c.unicode();
+}
+
+static bool isBefore(const NickMatcher::Match& one, const NickMatcher::Match& another)
+{
+    if (one.position != another.position)
+        return one.position < another.position;
+    return one.length > another.length;
+}
+
+NickMatcher::NickMatcher()
+{
+    clear();
+}
+
+bool NickMatcher::isEmpty() const
+{
+    return !d.count;
+}
+
+void NickMatcher::clear()
+{
+    Node root;
+    root.length = 0;
+    root.child = 0;
+    root.sibling = 0;
+
+    d.count = 0;
+    d.removed = 0;
+    d.nodes.clear();
+    d.nodes += root;
+    d.edges.clear();
+    d.dirty = true;
+}
+
+QStringList NickMatcher::names() const
+{
+    QStringList names;
+    QVector<int> nodes;
+    QStringList prefixes;
+    nodes += 0;
+    prefixes += QString();
+    while (!nodes.isEmpty()) {
+        const int node = nodes.last();
+        const QString prefix = prefixes.takeLast();
+        nodes.remove(nodes.count() - 1);
+        if (d.nodes.at(node).length)
+            names += prefix;
+        for (int child = d.nodes.at(node).child; child; child = d.nodes.at(child).sibling) {
+            nodes += child;
+            prefixes += prefix + d.nodes.at(child).c;
+        }
+    }
+    return names;
+}
+
+void NickMatcher::setNames(const QStringList& names)
+{
+    clear();
+    foreach (const QString& name, names)
+        addName(name);
+}
+
+QList<NickMatcher::Match> NickMatcher::match(const QString& html) const
+{
+    // one pass over the text outside of markup, collecting every name that
+    // starts and ends at a word boundary. overlapping matches are resolved
+    // leftmost first, and the longest of the ones starting at the same spot.
+    QList<Match> matches;
+    if (!d.count)
+        return matches;
+
+    compile();
+
+    QTextBoundaryFinder finder(QTextBoundaryFinder::Word, html);
+    const int len = html.length();
+    int state = 0;
+    int i = 0;
+    while (i < len) {
+        const QChar c = html.at(i);
+        if (c == QLatin1Char('<')) {
+            // do not match within tags, nor within links
+            int end = -1;
+            if (html.midRef(i, 3) == QLatin1String("<a ")) {
+                end = html.indexOf(QLatin1String("</a>"), i + 3);
+                if (end != -1)
+                    end += 3;
+            }
+            if (end == -1)
+                end = html.indexOf(QLatin1Char('>'), i + 1);
+            if (end != -1) {
+                state = 0;
+                i = end + 1;
+                continue;
+            }
+        } else if (c == QLatin1Char('&')) {
+            const int end = html.indexOf(QLatin1Char(';'), i + 1);
+            if (end != -1 && end - i <= 8) {
+                state = 0;
+                i = end + 1;
+                continue;
+            }
+        }
+
+        state = step(state, c);
+        int node = d.nodes.at(state).length ? state : d.output.at(state);
+        while (node) {
+            Match match;
+            match.length = d.nodes.at(node).length;
+            match.position = i + 1 - match.length;
+            finder.setPosition(match.position);
+            if (finder.isAtBoundary()) {
+                finder.setPosition(i + 1);
+                if (finder.isAtBoundary())
+                    matches += match;
+            }
+            node = d.output.at(node);
+        }
+        ++i;
+    }
+
+    if (matches.count() > 1) {
+        qSort(matches.begin(), matches.end(), isBefore);
+        int end = 0;
+        QList<Match>::iterator it = matches.begin();
+        while (it != matches.end()) {
+            if (it->position < end) {
+                it = matches.erase(it);
+            } else {
+                end = it->position + it->length;
+                ++it;
+            }
+        }
+    }
+    return matches;
+}
+
+void NickMatcher::addName(const QString& name)
+{
+    if (name.isEmpty())
+        return;
+
+    int node = 0;
+    foreach (const QChar& c, name) {
+        int next = edge(node, c);
+        if (next == -1) {
+            Node child;
+            child.c = c;
+            child.length = 0;
+            child.child = 0;
+            child.sibling = d.nodes.at(node).child;
+            next = d.nodes.count();
+            d.nodes += child;
+            d.nodes[node].child = next;
+            d.edges.insert(edgeKey(node, c), next);
+        }
+        node = next;
+    }
+    if (!d.nodes.at(node).length) {
+        d.nodes[node].length = name.length();
+        ++d.count;
+    }
+    d.dirty = true;
+}
+
+void NickMatcher::removeName(const QString& name)
+{
+    // the nodes stay in the trie until there are enough of them to
+    // make it worth building the trie again from the remaining names
+    int node = 0;
+    foreach (const QChar& c, name) {
+        node = edge(node, c);
+        if (node == -1)
+            return;
+    }
+    if (node && d.nodes.at(node).length) {
+        d.nodes[node].length = 0;
+        --d.count;
+        ++d.removed;
+        d.dirty = true;
+        if (d.removed > qMax(256, d.count))
+            compact();
+    }
+}
+
+void NickMatcher::compact()
+{
+    setNames(names());
+}
+
+void NickMatcher::compile() const
+{
+    // breadth first over the trie to build the failure links, and the
+    // output links that point to the next shorter name ending at a node
+    if (!d.dirty)
+        return;
+
+    const int count = d.nodes.count();
+    d.fail.fill(0, count);
+    d.output.fill(0, count);
+
+    QVector<int> queue;
+    queue.reserve(count);
+    for (int child = d.nodes.at(0).child; child; child = d.nodes.at(child).sibling)
+        queue += child;
+
+    for (int i = 0; i < queue.count(); ++i) {
+        const int node = queue.at(i);
+        for (int child = d.nodes.at(node).child; child; child = d.nodes.at(child).sibling) {
+            const QChar c = d.nodes.at(child).c;
+            int fail = d.fail.at(node);
+            int next = edge(fail, c);
+            while (next == -1 && fail) {
+                fail = d.fail.at(fail);
+                next = edge(fail, c);
+            }
+            d.fail[child] = qMax(0, next);
+            d.output[child] = d.nodes.at(d.fail.at(child)).length ? d.fail.at(child) : d.output.at(d.fail.at(child));
+            queue += child;
+        }
+    }
+    d.dirty = false;
+}
+
+int NickMatcher::edge(int node, QChar c) const
+{
+    return d.edges.value(edgeKey(node, c), -1);
+}
+
+int NickMatcher::step(int state, QChar c) const
+{
+    forever {
+        const int next = edge(state, c);
+        if (next != -1)
+            return next;
+        if (!state)
+            return 0;
+        state = d.fail.at(state);
+    }
+}
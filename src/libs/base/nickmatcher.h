@@ -0,0 +1,84 @@
+/*
+  Copyright (C) 2008-2015 The Communi Project
+
+  You may use this file under the terms of BSD license as follows:
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef NICKMATCHER_H
+#define NICKMATCHER_H
+
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QVector>
+#include <QStringList>
+
+class NickMatcher
+{
+public:
+    NickMatcher();
+
+    bool isEmpty() const;
+    void clear();
+
+    QStringList names() const;
+    void setNames(const QStringList& names);
+
+    void addName(const QString& name);
+    void removeName(const QString& name);
+
+    struct Match {
+        int position;
+        int length;
+    };
+
+    QList<Match> match(const QString& html) const;
+
+    void compile() const;
+
+private:
+    void compact();
+    int edge(int node, QChar c) const;
+    int step(int state, QChar c) const;
+
+    struct Node {
+        QChar c;
+        int length;
+        int child;
+        int sibling;
+    };
+
+    struct Private {
+        int count;
+        int removed;
+        QVector<Node> nodes;
+        QHash<quint64, int> edges;
+        mutable bool dirty;
+        mutable QVector<int> fail;
+        mutable QVector<int> output;
+    } d;
+};
+
+#endif // NICKMATCHER_H
@@ -28,6 +28,8 @@
 
 #include "textbrowser.h"
 #include "textdocument.h"
+#include "messagestore.h"
+#include "widgetcache.h"
 #include <QAbstractTextDocumentLayout>
 #include <QDesktopServices>
 #include <QStylePainter>
@@ -40,15 +42,34 @@
 #include <QKeyEvent>
 #include <QPainter>
 #include <QToolTip>
+#include <QTimer>
 #include <QAction>
 #include <QMenu>
 
 class TextShadow : public QFrame { Q_OBJECT };
 
+// the most recently viewed documents that have a snapshot
+static const int MaxSnapshots = 8;
+
+// scrolling and painting is coalesced to one display frame
+static const int FrameInterval = 16;
+
+// pages a document at the bottom keeps laid out while lines arrive
+static const int MaxPages = 4;
+
 TextBrowser::TextBrowser(QWidget* parent) : QTextBrowser(parent)
 {
     d.bud = 0;
+    d.latency = -1;
     d.events = true;
+    d.fetching = false;
+    d.stick = false;
+    d.framing = false;
+    d.frame = new QTimer(this);
+    d.frame->setSingleShot(true);
+    d.frame->setInterval(FrameInterval);
+    connect(d.frame, SIGNAL(timeout()), this, SLOT(updateFrame()));
+
     d.shadow = new TextShadow;
     d.shadow->setParent(this);
 
@@ -58,16 +79,22 @@ TextBrowser::TextBrowser(QWidget* parent) : QTextBrowser(parent)
     setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
 
     connect(this, SIGNAL(anchorClicked(QUrl)), this, SLOT(onAnchorClicked(QUrl)));
+    connect(verticalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(fetchMore()));
+    connect(verticalScrollBar(), SIGNAL(actionTriggered(int)), this, SLOT(onScrollAction(int)));
 }
 
 TextBrowser::~TextBrowser()
 {
-    TextDocument* doc = document();
-    if (doc) {
-        if (doc->isClone())
-            delete doc;
-        else
+    QList<TextDocument*> docs;
+    docs << document();
+    if (d.pending && d.pending != docs.first())
+        docs << d.pending;
+    foreach (TextDocument* doc, docs) {
+        if (doc) {
             doc->setVisible(false);
+            if (doc->isClone())
+                delete doc;
+        }
     }
 }
 
@@ -84,27 +111,154 @@ TextDocument* TextBrowser::document() const
     return qobject_cast<TextDocument*>(QTextBrowser::document());
 }
 
+TextDocument* TextBrowser::pendingDocument() const
+{
+    // shown from a snapshot, and attached from the event loop
+    return d.pending;
+}
+
 void TextBrowser::setDocument(TextDocument* document)
+{
+    if (document == (d.pending ? d.pending : this->document()))
+        return;
+
+    cancelFrame();
+    d.pending = 0;
+    d.snapshot = QPixmap();
+    d.switching.start();
+
+    // a document that still looks the way it did when it was last
+    // shown is painted from a snapshot right away, and attached once
+    // the event loop has had a chance to put the snapshot on screen
+    const QPixmap snapshot = takeSnapshot(document);
+    if (!snapshot.isNull()) {
+        d.pending = document;
+        d.snapshot = snapshot;
+        viewport()->repaint();
+        QMetaObject::invokeMethod(this, "attachPending", Qt::QueuedConnection);
+    } else {
+        attach(document);
+    }
+}
+
+int TextBrowser::switchLatency() const
+{
+    return d.latency;
+}
+
+void TextBrowser::attach(TextDocument* document)
 {
     TextDocument* doc = qobject_cast<TextDocument*>(QTextBrowser::document());
+    d.snapshot = QPixmap();
     if (doc != document) {
         if (doc) {
+            // hiding lets go of everything but the last page, which is
+            // all a snapshot shows, and would otherwise invalidate it
+            const bool bottom = isAtBottom();
             doc->setVisible(false);
+            if (bottom)
+                scrollToBottom();
+            saveSnapshot(doc);
             disconnect(doc->documentLayout(), SIGNAL(documentSizeChanged(QSizeF)), this, SLOT(keepAtBottom()));
             disconnect(doc, SIGNAL(lineRemoved(int)), this, SLOT(keepPosition(int)));
+            disconnect(doc, SIGNAL(linesPending()), this, SLOT(scheduleFrame()));
         }
         if (document) {
-            document->setVisible(true);
-            document->setDefaultFont(font());
+            // setting the default font invalidates the whole layout,
+            // even when the document already has the very same font
+            if (document->defaultFont() != font())
+                document->setDefaultFont(font());
+            document->setViewportHeight(viewport()->height());
             connect(document->documentLayout(), SIGNAL(documentSizeChanged(QSizeF)), this, SLOT(keepAtBottom()));
             connect(document, SIGNAL(lineRemoved(int)), this, SLOT(keepPosition(int)));
+            connect(document, SIGNAL(linesPending()), this, SLOT(scheduleFrame()));
         }
         connect(this, SIGNAL(textChanged()), this, SLOT(moveCursorToBottom()));
         QTextBrowser::setDocument(document);
+        // showing the document measures its lines, which is only worth
+        // doing once it has been laid out for the width of this viewport
+        if (document)
+            document->setVisible(true);
         disconnect(this, SIGNAL(textChanged()), this, SLOT(moveCursorToBottom()));
         scrollToBottom();
         emit documentChanged(document);
     }
+    viewport()->update();
+}
+
+void TextBrowser::attachPending()
+{
+    TextDocument* document = d.pending;
+    d.pending = 0;
+    if (document)
+        attach(document);
+}
+
+void TextBrowser::saveSnapshot(TextDocument* document)
+{
+    // only the bottom of a buffer is worth keeping, that is where
+    // switching to a buffer always ends up
+    for (int i = d.snapshots.count() - 1; i >= 0; --i) {
+        TextDocument* doc = d.snapshots.at(i).document;
+        if (!doc || doc == document || i >= MaxSnapshots - 1) {
+            if (doc) {
+                disconnect(doc, 0, this, SLOT(invalidateSnapshot()));
+                disconnect(doc->store(), 0, this, SLOT(invalidateSnapshot()));
+            }
+            d.snapshots.removeAt(i);
+        }
+    }
+
+    if (!isAtBottom() || viewport()->size().isEmpty())
+        return;
+
+    // grabbing paints, which is not the frame to measure
+    const QElapsedTimer switching = d.switching;
+    d.switching.invalidate();
+
+    Snapshot snapshot;
+    snapshot.pixmap = viewport()->grab();
+    d.switching = switching;
+    snapshot.document = document;
+    d.snapshots.prepend(snapshot);
+
+    connect(document, SIGNAL(contentsChanged()), this, SLOT(invalidateSnapshot()));
+    connect(document->store(), SIGNAL(lineAppended(int)), this, SLOT(invalidateSnapshot()));
+    connect(document->store(), SIGNAL(lineMerged()), this, SLOT(invalidateSnapshot()));
+    connect(document->store(), SIGNAL(cleared()), this, SLOT(invalidateSnapshot()));
+}
+
+QPixmap TextBrowser::takeSnapshot(TextDocument* document)
+{
+    // the snapshot is only good for the same size of the viewport
+    if (document) {
+        foreach (const Snapshot& snapshot, d.snapshots) {
+            if (snapshot.document == document) {
+                const QPixmap& pixmap = snapshot.pixmap;
+                if (pixmap.size() / pixmap.devicePixelRatio() == viewport()->size()
+                        && pixmap.devicePixelRatio() == WidgetCache::devicePixelRatio(viewport()))
+                    return pixmap;
+                break;
+            }
+        }
+    }
+    return QPixmap();
+}
+
+void TextBrowser::invalidateSnapshot()
+{
+    // new lines, a new style or a cleared buffer
+    QObject* source = sender();
+    for (int i = d.snapshots.count() - 1; i >= 0; --i) {
+        TextDocument* doc = d.snapshots.at(i).document;
+        if (!doc || doc == source || doc->store() == source) {
+            if (doc) {
+                disconnect(doc, 0, this, SLOT(invalidateSnapshot()));
+                disconnect(doc->store(), 0, this, SLOT(invalidateSnapshot()));
+            }
+            d.snapshots.removeAt(i);
+        }
+    }
 }
 
 QWidget* TextBrowser::buddy() const
@@ -117,6 +271,29 @@ void TextBrowser::setBuddy(QWidget* buddy)
     d.bud = buddy;
 }
 
+void TextBrowser::changeEvent(QEvent* event)
+{
+    // the theme is applied through the style sheet and the palette
+    switch (event->type()) {
+    case QEvent::FontChange:
+        collapseDocument(1);
+        // fall through
+    case QEvent::StyleChange:
+    case QEvent::PaletteChange:
+        foreach (const Snapshot& snapshot, d.snapshots) {
+            if (TextDocument* doc = snapshot.document) {
+                disconnect(doc, 0, this, SLOT(invalidateSnapshot()));
+                disconnect(doc->store(), 0, this, SLOT(invalidateSnapshot()));
+            }
+        }
+        d.snapshots.clear();
+        break;
+    default:
+        break;
+    }
+    QTextBrowser::changeEvent(event);
+}
+
 void TextBrowser::mousePressEvent(QMouseEvent* event)
 {
     const QUrl url(anchorAt(event->pos()));
@@ -172,10 +349,22 @@ void TextBrowser::keyPressEvent(QKeyEvent* event)
 
 void TextBrowser::resizeEvent(QResizeEvent* event)
 {
+    // the relayout for the new size only has the last page to go through
+    if (TextDocument* doc = document())
+        doc->setViewportHeight(event->size().height());
+    collapseDocument(1);
+
     QTextBrowser::resizeEvent(event);
 
     d.shadow->resize(width(), d.shadow->height());
 
+    // a snapshot of a different size is of no use
+    attachPending();
+
+    TextDocument* doc = document();
+    if (doc)
+        doc->setViewportHeight(viewport()->height());
+
     // http://www.qtsoftware.com/developer/task-tracker/index_html?method=entry&id=240940
     QMetaObject::invokeMethod(this, "scrollToBottom", Qt::QueuedConnection);
 }
@@ -291,6 +480,23 @@ void TextBrowser::paintEvent(QPaintEvent* event)
     // TODO: make sure the shadow is always on top (of transient scrollbars)
     d.shadow->raise();
 
+    if (!d.snapshot.isNull()) {
+        QPainter painter(viewport());
+        painter.drawPixmap(0, 0, d.snapshot);
+    } else {
+        paintDocument(event);
+    }
+
+    // from setDocument() to the first frame of the new document
+    if (d.switching.isValid()) {
+        d.latency = d.switching.elapsed();
+        d.switching.invalidate();
+        emit switchLatencyMeasured(d.latency);
+    }
+}
+
+void TextBrowser::paintDocument(QPaintEvent* event)
+{
     const int hoffset = horizontalScrollBar()->value();
     const int voffset = verticalScrollBar()->value();
     const QRect bounds = rect().translated(hoffset, voffset);
@@ -323,16 +529,94 @@ void TextBrowser::wheelEvent(QWheelEvent* event)
 
 void TextBrowser::keepAtBottom()
 {
-    if (isAtBottom())
-        QMetaObject::invokeMethod(this, "scrollToBottom", Qt::QueuedConnection);
+    if (!d.framing)
+        scheduleFrame();
 }
 
 void TextBrowser::keepPosition(int delta)
 {
+    // a browser that sticks to the bottom gets scrolled there by the
+    // frame, the scroll bar maximum may have grown past it meanwhile
     if (!isAtBottom())
         verticalScrollBar()->setValue(verticalScrollBar()->value() - delta);
 }
 
+void TextBrowser::scheduleFrame()
+{
+    // lines are appended to the store as they arrive, but the document
+    // lays them out, scrolls and paints only once per frame
+    if (!d.frame->isActive()) {
+        d.stick = isAtBottom();
+        if (d.stick)
+            viewport()->setUpdatesEnabled(false);
+        d.frame->start();
+    }
+}
+
+void TextBrowser::updateFrame()
+{
+    d.framing = true;
+    TextDocument* doc = document();
+    if (doc && doc->pendingCount() > 0)
+        doc->flush();
+    if (d.stick) {
+        scrollToBottom();
+        collapseDocument(MaxPages);
+        scrollToBottom();
+    }
+    d.stick = false;
+    d.framing = false;
+    viewport()->setUpdatesEnabled(true);
+}
+
+void TextBrowser::onScrollAction(int action)
+{
+    // the user scrolled away before the frame got to scroll to the bottom
+    if (action != QAbstractSlider::SliderToMaximum)
+        d.stick = false;
+}
+
+void TextBrowser::collapseDocument(int pages)
+{
+    // while at the bottom, the lines above the last page are let go of
+    // once there are more than the given pages of them, so that neither
+    // the scrollback nor a long session makes relayouts any slower
+    TextDocument* doc = document();
+    if (doc && isAtBottom()) {
+        const int count = doc->lastLine() - doc->firstLine();
+        const int page = doc->pageSize();
+        if (count > pages * page)
+            doc->collapse(count - page);
+    }
+}
+
+void TextBrowser::cancelFrame()
+{
+    d.stick = false;
+    if (d.frame->isActive()) {
+        d.frame->stop();
+        viewport()->setUpdatesEnabled(true);
+    }
+}
+
+void TextBrowser::fetchMore()
+{
+    // lay out more lines once scrolled close to the estimated
+    // area at the top, and compensate for the estimation error
+    TextDocument* doc = document();
+    if (doc && !d.fetching) {
+        d.fetching = true;
+        QScrollBar* bar = verticalScrollBar();
+        while (doc->canFetchMore(bar->value())) {
+            const qreal before = doc->documentLayout()->documentSize().height();
+            doc->fetchMore();
+            const qreal after = doc->documentLayout()->documentSize().height();
+            bar->setValue(bar->value() + qRound(after - before));
+        }
+        d.fetching = false;
+    }
+}
+
 void TextBrowser::moveCursorToBottom()
 {
     QTextCursor cursor = textCursor();
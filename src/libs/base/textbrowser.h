@@ -30,7 +30,12 @@
 #define TEXTBROWSER_H
 
 #include <QTextBrowser>
+#include <QElapsedTimer>
+#include <QPointer>
+#include <QPixmap>
+#include <QList>
 
+class QTimer;
 class IrcBuffer;
 class TextShadow;
 class TextDocument;
@@ -48,6 +53,8 @@ public:
     TextDocument* document() const;
     void setDocument(TextDocument* document);
 
+    TextDocument* pendingDocument() const;
+
     QWidget* buddy() const;
     void setBuddy(QWidget* buddy);
 
@@ -55,6 +62,8 @@ public:
     bool isAtBottom() const;
     bool isZoomed() const;
 
+    int switchLatency() const;
+
     QMenu* createContextMenu(const QPoint& pos);
 
 public slots:
@@ -69,8 +78,10 @@ public slots:
 signals:
     void queried(const QString& user);
     void documentChanged(TextDocument* document);
+    void switchLatencyMeasured(int msecs);
 
 protected:
+    void changeEvent(QEvent* event);
     void mousePressEvent(QMouseEvent* event);
     void mouseMoveEvent(QMouseEvent* event);
     void keyPressEvent(QKeyEvent* event);
@@ -81,17 +92,44 @@ protected:
 private slots:
     void keepAtBottom();
     void keepPosition(int delta);
+    void fetchMore();
     void moveShadow(int offset);
     void onAnchorClicked(const QUrl& url);
+    void attachPending();
+    void scheduleFrame();
+    void updateFrame();
+    void onScrollAction(int action);
+    void invalidateSnapshot();
 
     void onWhoisTriggered();
     void onQueryTriggered();
 
 private:
+    void attach(TextDocument* document);
+    void paintDocument(QPaintEvent* event);
+    void cancelFrame();
+    void collapseDocument(int pages);
+    void saveSnapshot(TextDocument* document);
+    QPixmap takeSnapshot(TextDocument* document);
+
+    struct Snapshot {
+        QPixmap pixmap;
+        QPointer<TextDocument> document;
+    };
+
     struct Private {
         bool events;
+        bool fetching;
+        bool stick;
+        bool framing;
+        int latency;
         QWidget* bud;
+        QTimer* frame;
+        QPixmap snapshot;
         TextShadow* shadow;
+        QElapsedTimer switching;
+        QList<Snapshot> snapshots;
+        QPointer<TextDocument> pending;
     } d;
 };
 
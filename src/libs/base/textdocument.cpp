@@ -27,14 +27,18 @@
 */
 
 #include "textdocument.h"
+#include "messagestore.h"
+#include "flushscheduler.h"
 #include "eventformatter.h"
+#include "eventaggregate.h"
+#include "widgetcache.h"
 #include <QAbstractTextDocumentLayout>
-#include <QTextDocumentFragment>
 #include <QTextBlockUserData>
 #include <IrcConnection>
 #include <QStylePainter>
 #include <QApplication>
 #include <QStyleOption>
+#include <QFontMetricsF>
 #include <QTextCursor>
 #include <QTextBlock>
 #include <IrcMessage>
@@ -43,10 +47,10 @@
 #include <QPointer>
 #include <QPainter>
 #include <QFrame>
+#include <QHash>
+#include <QSet>
 #include <qmath.h>
 
-static int delay = 1000;
-
 class TextFrame : public QFrame
 {
 public:
@@ -57,6 +61,12 @@ public:
         setAttribute(Qt::WA_NoSystemBackground);
     }
 
+    QPixmap pixmap(const QSize& size, qreal ratio)
+    {
+        return cache.pixmap(this, size, ratio);
+    }
+
+protected:
     void paintEvent(QPaintEvent*)
     {
         QStyleOption option;
@@ -64,6 +74,17 @@ public:
         QStylePainter painter(this);
         painter.drawPrimitive(QStyle::PE_Widget, option);
     }
+
+    void changeEvent(QEvent* event)
+    {
+        // a new theme
+        if (event->type() == QEvent::StyleChange || event->type() == QEvent::PaletteChange)
+            cache.clear();
+        QFrame::changeEvent(event);
+    }
+
+private:
+    WidgetCache cache;
 };
 
 class TextHighlight : public TextFrame
@@ -86,28 +107,81 @@ struct TextBlockMessageData : QTextBlockUserData
     MessageData data;
 };
 
+enum TextProperty {
+    StyleProperty = QTextFormat::UserProperty,
+    WhiteSpaceProperty
+};
+
+static const int MaxTooltipEvents = 25;
+static const int MaxTooltipNicks = 100;
+
+static QTextCharFormat resolveStyle(const QString& css, int style)
+{
+    // resolves the markup a style id stands for through the style sheet,
+    // the same way the HTML importer would for a span of that markup
+    static QHash<QString, QHash<int, QTextCharFormat> > cache;
+    QHash<int, QTextCharFormat>& styles = cache[css];
+    if (!styles.contains(style)) {
+        const QString markup = TextRuns::styleMarkup(style);
+        QString closing;
+        int pos = markup.indexOf(QLatin1Char('<'));
+        while (pos != -1) {
+            int end = pos + 1;
+            while (end < markup.length() && markup.at(end).isLetter())
+                ++end;
+            closing.prepend(QString("</%1>").arg(markup.mid(pos + 1, end - pos - 1)));
+            pos = markup.indexOf(QLatin1Char('<'), end);
+        }
+
+        QTextDocument doc;
+        doc.setDefaultStyleSheet(css);
+        doc.setHtml(markup + "x  x" + closing);
+        QTextCursor cursor(&doc);
+        cursor.movePosition(QTextCursor::NextCharacter);
+        QTextCharFormat format = cursor.charFormat();
+        format.clearProperty(QTextFormat::IsAnchor);
+        format.clearProperty(QTextFormat::AnchorHref);
+        format.clearProperty(QTextFormat::AnchorName);
+        format.setProperty(WhiteSpaceProperty, doc.toPlainText().contains("  "));
+        styles.insert(style, format);
+    }
+    return styles.value(style);
+}
+
+static bool isCollapsible(QChar c)
+{
+    return c == QLatin1Char(' ') || c == QLatin1Char('\t') || c == QLatin1Char('\n') || c == QLatin1Char('\r');
+}
+
 TextDocument::TextDocument(IrcBuffer* buffer) : QTextDocument(buffer)
 {
     qRegisterMetaType<TextDocument*>();
 
     d.uc = 0;
-    d.dirty = -1;
-    d.rebuild = -1;
+    d.base = 0;
+    d.first = 0;
+    d.last = 0;
+    d.spacer = 0;
+    d.viewport = 0;
     d.lowlight = -1;
     d.clone = false;
     d.batch = false;
     d.buffer = buffer;
     d.visible = false;
+    d.stamp = -1;
 
-    d.formatter = new MessageFormatter(this);
-    connect(d.formatter, SIGNAL(formatted(MessageData)), this, SLOT(append(MessageData)));
-    d.formatter->setBuffer(buffer);
+    d.store = MessageStore::instance(buffer);
+    connect(d.store, SIGNAL(cleared()), this, SLOT(onCleared()));
+    connect(d.store, SIGNAL(lineAppended(int)), this, SLOT(onLineAppended(int)));
+    connect(d.store, SIGNAL(linesPrepended(int)), this, SLOT(onLinesPrepended(int)));
+    connect(d.store, SIGNAL(lineMerged()), this, SLOT(onLineMerged()));
+    connect(d.store, SIGNAL(batchFinished()), this, SLOT(onBatchFinished()));
+    connect(d.store, SIGNAL(messageReceived(IrcMessage*,MessageData)), this, SLOT(onMessageReceived(IrcMessage*,MessageData)));
 
     setUndoRedoEnabled(false);
-    setMaximumBlockCount(1000);
+    setMaximumBlockCount(d.store->capacity());
 
     connect(buffer->connection(), SIGNAL(disconnected()), this, SLOT(lowlight()));
-    connect(buffer, SIGNAL(messageReceived(IrcMessage*)), this, SLOT(receiveMessage(IrcMessage*)));
 }
 
 QString TextDocument::timeStampFormat() const
@@ -118,8 +192,10 @@ QString TextDocument::timeStampFormat() const
 void TextDocument::setTimeStampFormat(const QString& format)
 {
     if (d.timeStampFormat != format) {
+        const QString previous = d.timeStampFormat;
         d.timeStampFormat = format;
-        scheduleRebuild();
+        d.stamp = -1;
+        restyle(d.css, previous);
     }
 }
 
@@ -131,31 +207,32 @@ QString TextDocument::styleSheet() const
 void TextDocument::setStyleSheet(const QString& css)
 {
     if (d.css != css) {
+        const QString previous = d.css;
         d.css = css;
         setDefaultStyleSheet(css);
-        scheduleRebuild();
+        restyle(previous, d.timeStampFormat);
     }
 }
 
 TextDocument* TextDocument::clone()
 {
-    if (d.dirty > 0)
-        flush();
-
     TextDocument* doc = new TextDocument(d.buffer);
     doc->setDefaultStyleSheet(defaultStyleSheet());
-    QTextCursor(doc).insertFragment(QTextDocumentFragment(this));
-    doc->rootFrame()->setFrameFormat(rootFrame()->frameFormat());
+    doc->setDefaultFont(defaultFont());
 
     // TODO:
     doc->d.uc = d.uc;
+    doc->d.base = d.base;
     doc->d.css = d.css;
     doc->d.lowlight = d.lowlight;
     doc->d.buffer = d.buffer;
+    doc->d.viewport = d.viewport;
     doc->d.highlights = d.highlights;
     doc->d.timeStampFormat = d.timeStampFormat;
     doc->d.clone = true;
 
+    // the lines are shared with the store, nothing gets laid
+    // out until the clone is shown in a view
     return doc;
 }
 
@@ -169,17 +246,79 @@ IrcBuffer* TextDocument::buffer() const
     return d.buffer;
 }
 
+MessageStore* TextDocument::store() const
+{
+    return d.store;
+}
+
 MessageFormatter* TextDocument::formatter() const
 {
-    return d.formatter;
+    return d.store->formatter();
 }
 
 int TextDocument::totalCount() const
 {
-    int count = d.queue.count();
-    if (!isEmpty())
-        count += blockCount();
-    return count;
+    return d.store->count();
+}
+
+int TextDocument::firstLine() const
+{
+    return d.first;
+}
+
+int TextDocument::lastLine() const
+{
+    return d.last;
+}
+
+int TextDocument::pendingCount() const
+{
+    // lines in the store that are not laid out yet
+    return d.store->count() - d.last;
+}
+
+bool TextDocument::hasPendingHighlight() const
+{
+    // a highlight among the lines the user has not seen yet
+    return !d.highlights.isEmpty() && d.highlights.last() >= d.store->count() - d.uc;
+}
+
+int TextDocument::viewportHeight() const
+{
+    return d.viewport;
+}
+
+void TextDocument::setViewportHeight(int height)
+{
+    d.viewport = height;
+}
+
+bool TextDocument::canFetchMore(int y) const
+{
+    return d.first > d.base && y < qCeil(documentMargin()) + d.spacer + d.viewport;
+}
+
+void TextDocument::fetchMore()
+{
+    if (d.first > d.base) {
+        const int count = qMin(d.first - d.base, pageSize());
+        QTextCursor cursor(this);
+        cursor.beginEditBlock();
+        for (int i = 1; i <= count; ++i)
+            prepend(cursor, d.store->format(d.first - i));
+        cursor.endEditBlock();
+        d.first -= count;
+
+        // inserting a block in front of the first one may hand its
+        // user data and format over to the new block, so re-attach
+        QTextBlock block = firstBlock();
+        for (int i = d.first; i < d.last && block.isValid() && i <= d.first + count; ++i) {
+            resetBlock(block, d.store->at(i));
+            block = block.next();
+        }
+
+        updateSpacer();
+    }
 }
 
 bool TextDocument::isVisible() const
@@ -191,23 +330,30 @@ void TextDocument::setVisible(bool visible)
 {
     if (d.visible != visible) {
         if (visible) {
-            if (d.dirty > 0)
+            // the first viewer has the store read its history
+            d.store->addViewer();
+            if (d.last < d.store->count())
                 flush();
         } else {
+            d.store->removeViewer();
             d.uc = 0;
-            if (TextBlockMessageData* block = static_cast<TextBlockMessageData*>(lastBlock().userData()))
-                d.timestamp = block->data.timestamp();
+            if (!d.store->isEmpty())
+                d.timestamp = d.store->last().timestamp();
         }
         d.visible = visible;
+        if (visible) {
+            updateSpacer();
+        } else {
+            // let go of the layout of everything but the last page
+            collapse(d.last - d.first - pageSize());
+        }
     }
 }
 
 QDateTime TextDocument::timestamp() const
 {
-    if (d.visible) {
-        if (TextBlockMessageData* block = static_cast<TextBlockMessageData*>(lastBlock().userData()))
-            return block->data.timestamp();
-    }
+    if (d.visible && !d.store->isEmpty())
+        return d.store->last().timestamp();
     return d.timestamp;
 }
 
@@ -222,7 +368,7 @@ void TextDocument::lowlight(int block)
         block = totalCount() - 1;
     if (d.lowlight != block) {
         d.lowlight = block;
-        updateBlock(block);
+        updateLine(block);
     }
 }
 
@@ -234,85 +380,51 @@ void TextDocument::addHighlight(int block)
     if (block >= 0 && block <= max) {
         QList<int>::iterator it = qLowerBound(d.highlights.begin(), d.highlights.end(), block);
         d.highlights.insert(it, block);
-        updateBlock(block);
+        updateLine(block);
     }
 }
 
 void TextDocument::removeHighlight(int block)
 {
     if (d.highlights.removeOne(block) && block >= 0 && block < totalCount())
-        updateBlock(block);
+        updateLine(block);
 }
 
 void TextDocument::reset()
 {
+    // clears this view only, the lines remain in the store that the
+    // other views of the buffer share and that the log was written from
+    clear();
     d.uc = 0;
     d.lowlight = -1;
     d.highlights.clear();
-    d.queue.clear();
+    d.base = d.store->count();
+    d.first = d.base;
+    d.last = d.base;
+    d.spacer = 0;
+    FlushScheduler::instance()->cancel(this);
 }
 
 void TextDocument::append(const MessageData& data)
 {
-    if (!data.isEmpty()) {
-        MessageData last;
-        if (!d.queue.isEmpty())
-            last = d.queue.last();
-        else if (TextBlockMessageData* block = static_cast<TextBlockMessageData*>(lastBlock().userData()))
-            last = block->data;
-
-        if (!last.isEmpty() && data.type() != IrcMessage::Unknown && data.timestamp().date() != last.timestamp().date()) {
-            MessageData dc;
-            dc.setFormat(QString("<p class='date'>%1</p>").arg(data.timestamp().date().toString(Qt::ISODate)));
-            append(dc);
-        }
+    d.store->append(data);
+}
 
-        MessageData msg = data;
-        const bool merge = last.canMerge(data);
-        if (merge) {
-            msg.merge(last);
-            msg.setFormat(formatSummary(msg.getEvents()));
-            if (!d.queue.isEmpty())
-                d.queue.replace(d.queue.count() - 1, msg);
-        } else {
-            if (d.timestamp < data.timestamp())
-                ++d.uc;
-            else
-                d.uc = 0;
-        }
-        if (!d.batch && (d.dirty == 0 || d.visible)) {
-            QTextCursor cursor(this);
-            cursor.beginEditBlock();
-            if (merge) {
-                cursor.movePosition(QTextCursor::End);
-                cursor.movePosition(QTextCursor::StartOfBlock, QTextCursor::KeepAnchor);
-                cursor.removeSelectedText();
-                cursor.deletePreviousChar();
-            }
-            insert(cursor, msg);
-            cursor.endEditBlock();
-        } else {
-            if (!d.batch && d.dirty <= 0) {
-                d.dirty = startTimer(delay);
-                delay += 1000;
-            }
-            if (!merge)
-                d.queue += msg;
-        }
-    }
+void TextDocument::receiveMessage(IrcMessage* message)
+{
+    d.store->receiveMessage(message);
 }
 
 void TextDocument::drawForeground(QPainter* painter, const QRect& bounds)
 {
-    const int num = blockCount() - d.uc;
+    const int num = d.store->count() - d.uc;
     if (num > 0) {
         const QPen oldPen = painter->pen();
         const QBrush oldBrush = painter->brush();
         painter->setBrush(Qt::NoBrush);
         painter->setPen(QPen(QPalette().color(QPalette::Mid), 1, Qt::DashLine));
-        QTextBlock block = findBlockByNumber(num);
-        if (block.isValid()) {
-            QRect br = documentLayout()->blockBoundingRect(block).toAlignedRect();
+        QRect br = lineRect(num);
+        if (br.isValid()) {
             if (bounds.intersects(br)) {
                 QLine line(br.topLeft(), br.topRight());
                 line.translate(0, -2);
@@ -330,7 +442,6 @@ void TextDocument::drawBackground(QPainter* painter, const QRect& bounds)
         return;
 
     const int margin = qCeil(documentMargin());
-    const QAbstractTextDocumentLayout* layout = documentLayout();
 
     static QPointer<TextLowlight> lowlightFrame = 0;
     if (!lowlightFrame)
@@ -340,33 +451,35 @@ void TextDocument::drawBackground(QPainter* painter, const QRect& bounds)
     if (!highlightFrame)
         highlightFrame = new TextHighlight(static_cast<QWidget*>(painter->device()));
 
+    const qreal ratio = WidgetCache::devicePixelRatio(painter->device());
+
     if (d.lowlight != -1) {
-        const QAbstractTextDocumentLayout* layout = documentLayout();
-        const int margin = qCeil(documentMargin());
-        const QTextBlock to = findBlockByNumber(d.lowlight);
-        if (to.isValid()) {
-            QRect br = layout->blockBoundingRect(to).toAlignedRect();
+        QRect br = lineRect(d.lowlight);
+        if (br.isValid()) {
             br.setTop(0);
             if (bounds.intersects(br)) {
                 br.adjust(-margin - 1, 0, margin + 1, 2);
-                painter->translate(br.topLeft());
-                lowlightFrame->setGeometry(br);
-                lowlightFrame->render(painter);
-                painter->translate(-br.topLeft());
+                // it reaches up to the top of the document, only a viewport
+                // worth of it is painted with the edges kept out of sight,
+                // so that scrolling does not produce a new size every time
+                const int height = bounds.height() + 4;
+                if (br.height() > height) {
+                    if (br.bottom() > bounds.bottom())
+                        br = QRect(br.left(), bounds.top() - 2, br.width(), height);
+                    else
+                        br.setTop(br.bottom() - height + 1);
+                }
+                painter->drawPixmap(br.topLeft(), lowlightFrame->pixmap(br.size(), ratio));
             }
         }
     }
 
     foreach (int highlight, d.highlights) {
-        QTextBlock block = findBlockByNumber(highlight);
-        if (block.isValid()) {
-            QRect br = layout->blockBoundingRect(block).toAlignedRect();
+        QRect br = lineRect(highlight);
+        if (br.isValid()) {
             if (bounds.intersects(br)) {
                 br.adjust(-margin - 1, 0, margin + 1, 2);
-                painter->translate(br.topLeft());
-                highlightFrame->setGeometry(br);
-                highlightFrame->render(painter);
-                painter->translate(-br.topLeft());
+                painter->drawPixmap(br.topLeft(), highlightFrame->pixmap(br.size(), ratio));
             }
         }
     }
@@ -377,125 +490,218 @@ QString TextDocument::tooltip(const QPoint& point) const
     const int pos = documentLayout()->hitTest(point, Qt::FuzzyHit);
     const QTextBlock block = findBlock(pos);
     TextBlockMessageData* blockData = static_cast<TextBlockMessageData*>(block.userData());
-    if (blockData)
-        return formatEvents(blockData->data.getEvents());
+    if (blockData) {
+        QSharedPointer<EventAggregate> events = blockData->data.aggregate();
+        if (!events) {
+            events = QSharedPointer<EventAggregate>(new EventAggregate);
+            events->add(blockData->data);
+        }
+        return formatEvents(events.data());
+    }
     return QString();
 }
 
-void TextDocument::updateBlock(int number)
+void TextDocument::updateLine(int line)
 {
-    if (d.visible) {
-        QTextBlock block = findBlockByNumber(number);
+    if (d.visible && line >= d.first && line < d.last) {
+        QTextBlock block = findBlockByNumber(line - d.first);
         if (block.isValid())
             QMetaObject::invokeMethod(documentLayout(), "updateBlock", Q_ARG(QTextBlock, block));
     }
 }
 
-void TextDocument::timerEvent(QTimerEvent* event)
+void TextDocument::flush()
 {
-    QTextDocument::timerEvent(event);
-    if (event->timerId() == d.dirty) {
-        delay -= 1000;
-        flush();
-    } else if (event->timerId() == d.rebuild) {
-        rebuild();
+    const int count = d.store->count();
+    if (d.last < d.base)
+        d.first = d.last = d.base;
+    if (d.last < count) {
+        const int page = pageSize();
+        const bool reset = count - d.last > page;
+        if (reset) {
+            // too far behind to bother, lay out the last page only
+            clear();
+            d.first = d.last = qMax(d.base, count - page);
+        }
+        QTextCursor cursor(this);
+        cursor.beginEditBlock();
+        for (; d.last < count; ++d.last)
+            insert(cursor, d.store->format(d.last));
+        cursor.endEditBlock();
+        if (reset)
+            updateSpacer();
     }
+
+    FlushScheduler::instance()->cancel(this);
 }
 
-void TextDocument::flush()
+bool TextDocument::prepare()
+{
+    // formats and lays out the last page of a hidden document ahead of
+    // time, so that showing it has nothing left to do. a document that
+    // has never been shown has no width to lay out for.
+    if (d.visible || d.last >= d.store->count())
+        return false;
+    flush();
+    if (textWidth() > 0)
+        documentLayout()->documentSize();
+    return true;
+}
+
+void TextDocument::onCleared()
+{
+    clear();
+    d.uc = 0;
+    d.lowlight = -1;
+    d.highlights.clear();
+    d.base = 0;
+    d.first = 0;
+    d.last = 0;
+    d.spacer = 0;
+}
+
+void TextDocument::onLineAppended(int dropped)
+{
+    if (d.timestamp < d.store->last().timestamp())
+        ++d.uc;
+    else
+        d.uc = 0;
+    // unread lines may have been dropped from the top of the ring
+    d.uc = qMin(d.uc, d.store->count());
+    trim(dropped);
+    if (d.store->isBatch())
+        return;
+    // the browser showing the document lays out once per frame,
+    // and a flood is laid out in batches by the scheduler
+    if (d.visible && !d.store->isFirehose())
+        emit linesPending();
+    else if (d.visible || !d.store->isLazy())
+        FlushScheduler::instance()->schedule(this);
+}
+
+void TextDocument::onLinesPrepended(int count)
+{
+    // history from the log went in front of everything, and a view
+    // that has been cleared keeps it hidden
+    if (d.base > 0)
+        d.base += count;
+    d.first += count;
+    d.last += count;
+    shiftLights(-count);
+    updateSpacer();
+}
+
+void TextDocument::onLineMerged()
 {
-    if (!d.queue.isEmpty()) {
+    // the merged line is always the last one, a line from before
+    // the view was cleared has no block of its own to replace
+    if (d.last > d.first && d.last == d.store->count()) {
+        // the merged line is laid out, replace it in place
         QTextCursor cursor(this);
         cursor.beginEditBlock();
-        foreach (const MessageData& data, d.queue)
-            insert(cursor, data);
+        cursor.movePosition(QTextCursor::End);
+        cursor.movePosition(QTextCursor::StartOfBlock, QTextCursor::KeepAnchor);
+        cursor.removeSelectedText();
+        cursor.deletePreviousChar();
+        insert(cursor, d.store->last());
         cursor.endEditBlock();
-        d.queue.clear();
     }
+}
 
-    if (d.dirty > 0) {
-        killTimer(d.dirty);
-        d.dirty = 0;
-    }
+void TextDocument::onBatchFinished()
+{
+    // the scheduler flushes visible documents first, and lazy
+    // documents are left alone until they become visible
+    if (d.last < d.store->count() && (d.visible || !d.store->isLazy()))
+        FlushScheduler::instance()->schedule(this);
 }
 
-void TextDocument::receiveMessage(IrcMessage* message)
+void TextDocument::onMessageReceived(IrcMessage* message, const MessageData& data)
 {
-    if (message->type() == IrcMessage::Batch) {
-        IrcBatchMessage* batch = static_cast<IrcBatchMessage*>(message);
-        d.batch = true;
-        foreach (IrcMessage* msg, batch->messages())
-            receiveMessage(msg);
-        d.batch = false;
-        if (!d.queue.isEmpty()) {
-            if (d.visible) {
-                flush();
-            } else if (d.dirty <= 0) {
-                d.dirty = startTimer(delay);
-                delay += 1000;
-            }
-        }
-    } else {
-        MessageData data = d.formatter->formatMessage(message);
-        if (!data.isEmpty()) {
-            append(data);
+    if (data.type() == IrcMessage::Private || data.type() == IrcMessage::Notice) {
+        bool unseen = d.timestamp < message->timeStamp();
+        // listeners look up the block of their own lines, which batched
+        // or coalesced appends would otherwise not have laid out yet
+        if (message->isOwn() && d.visible && d.last < d.store->count())
+            flush();
+        if (unseen)
+            emit messageReceived(message);
 
-            if (data.type() == IrcMessage::Private || data.type() == IrcMessage::Notice) {
-                bool unseen = d.timestamp < message->timeStamp();
+        if (!message->isOwn()) {
+            QString content;
+            bool priv = false;
+            if (data.type() == IrcMessage::Private) {
+                IrcPrivateMessage* pm = static_cast<IrcPrivateMessage*>(message);
+                content = pm->content();
+                priv = pm->isPrivate();
+            } else {
+                IrcNoticeMessage* nm = static_cast<IrcNoticeMessage*>(message);
+                content = nm->content();
+                priv = nm->isPrivate();
+            }
+            IrcConnection* connection = message->connection();
+            const bool contains = content.contains(connection->nickName(), Qt::CaseInsensitive);
+            if (contains) {
+                if (connection->isConnected())
+                    addHighlight(totalCount() - 1);
                 if (unseen)
-                    emit messageReceived(message);
-
-                if (!message->isOwn()) {
-                    QString content;
-                    bool priv = false;
-                    if (data.type() == IrcMessage::Private) {
-                        IrcPrivateMessage* pm = static_cast<IrcPrivateMessage*>(message);
-                        content = pm->content();
-                        priv = pm->isPrivate();
-                    } else {
-                        IrcNoticeMessage* nm = static_cast<IrcNoticeMessage*>(message);
-                        content = nm->content();
-                        priv = nm->isPrivate();
-                    }
-                    IrcConnection* connection = message->connection();
-                    const bool contains = content.contains(connection->nickName(), Qt::CaseInsensitive);
-                    if (contains) {
-                        if (connection->isConnected())
-                            addHighlight(totalCount() - 1);
-                        if (unseen)
-                            emit messageHighlighted(message);
-                    } else if (unseen && priv && connection->isConnected()) {
-                        emit privateMessageReceived(message);
-                    }
-                }
+                    emit messageHighlighted(message);
+            } else if (unseen && priv && connection->isConnected()) {
+                emit privateMessageReceived(message);
             }
         }
     }
 }
 
-void TextDocument::rebuild()
+void TextDocument::restyle(const QString& css, const QString& timeStampFormat)
 {
-    QList<MessageData> lines;
-    QTextBlock block = firstBlock();
-    while (block.isValid()) {
+    // updates the laid out lines in place after the style sheet or the
+    // timestamp format has changed from the given ones. the spans of lines
+    // inserted as runs know their style, and simply get it resolved again.
+    if (css != d.css)
+        d.styles.clear();
+    if (d.first == d.last)
+        return;
+
+    const bool restamp = timeStampFormat != d.timeStampFormat;
+
+    QTextCursor cursor(this);
+    cursor.beginEditBlock();
+    for (QTextBlock block = firstBlock(); block.isValid(); block = block.next()) {
         TextBlockMessageData* blockData = static_cast<TextBlockMessageData*>(block.userData());
-        if (blockData)
-            lines += blockData->data;
-        block = block.next();
-    }
-    clear();
-    d.queue = lines;
-    flush();
-    if (d.rebuild > 0) {
-        killTimer(d.rebuild);
-        d.rebuild = 0;
+        if (!blockData || blockData->data.format().isEmpty())
+            continue;
+
+        const MessageData data = blockData->data;
+        if (restamp || !data.runs().isValid()) {
+            cursor.setPosition(block.position());
+            cursor.movePosition(QTextCursor::EndOfBlock, QTextCursor::KeepAnchor);
+            cursor.removeSelectedText();
+            insertLine(cursor, data);
+            block = cursor.block();
+            resetBlock(block, data);
+        } else {
+            QList<QTextFragment> fragments;
+            for (QTextBlock::iterator it = block.begin(); !it.atEnd(); ++it) {
+                if (it.fragment().charFormat().hasProperty(StyleProperty))
+                    fragments += it.fragment();
+            }
+            foreach (const QTextFragment& fragment, fragments) {
+                const QTextCharFormat previous = fragment.charFormat();
+                QTextCharFormat format = styleFormat(previous.intProperty(StyleProperty));
+                format.clearProperty(WhiteSpaceProperty);
+                format.setProperty(StyleProperty, previous.intProperty(StyleProperty));
+                if (previous.isAnchor()) {
+                    format.setAnchor(true);
+                    format.setAnchorHref(previous.anchorHref());
+                }
+                cursor.setPosition(fragment.position());
+                cursor.setPosition(fragment.position() + fragment.length(), QTextCursor::KeepAnchor);
+                cursor.setCharFormat(format);
+            }
+        }
     }
-}
-
-void TextDocument::scheduleRebuild()
-{
-    if (d.rebuild < 0 && !isEmpty())
-        d.rebuild = startTimer(isVisible() ? 0 : 1000);
+    cursor.endEditBlock();
 }
 
 void TextDocument::shiftLights(int diff)
@@ -508,28 +714,192 @@ void TextDocument::shiftLights(int diff)
         else
             ++it;
     }
-    d.lowlight -= diff;
+    if (d.lowlight != -1)
+        d.lowlight = qMax(-1, d.lowlight - diff);
+}
+
+void TextDocument::trim(int count)
+{
+    if (count > 0) {
+        shiftLights(count);
+        const int removed = qMax(0, qMin(d.last, count) - d.first);
+        const int spacer = d.spacer;
+        const int first = d.first;
+        d.base = qMax(0, d.base - count);
+        d.first = qMax(0, d.first - count);
+        d.last = qMax(0, d.last - count);
+        if (removed > 0) {
+            const QRectF br = documentLayout()->blockBoundingRect(findBlockByNumber(removed - 1));
+            if (d.first == d.last) {
+                clear();
+            } else {
+                QTextCursor cursor(this);
+                cursor.movePosition(QTextCursor::NextBlock, QTextCursor::KeepAnchor, removed);
+                cursor.removeSelectedText();
+                resetBlock(firstBlock(), d.store->at(d.first));
+            }
+            if (first != d.first)
+                updateSpacer();
+            emit lineRemoved(qRound(br.bottom()));
+        } else if (first != d.first) {
+            // only estimated lines above the window were dropped
+            updateSpacer();
+            if (spacer != d.spacer)
+                emit lineRemoved(spacer - d.spacer);
+        }
+    }
+}
+
+void TextDocument::collapse(int count)
+{
+    // drops 'count' lines from the top of the layout, they remain in
+    // the ring and get estimated heights until fetched back again
+    count = qMin(count, d.last - d.first);
+    if (count > 0) {
+        if (count == d.last - d.first) {
+            clear();
+            d.first = d.last;
+        } else {
+            QTextCursor cursor(this);
+            cursor.movePosition(QTextCursor::NextBlock, QTextCursor::KeepAnchor, count);
+            cursor.removeSelectedText();
+            d.first += count;
+            resetBlock(firstBlock(), d.store->at(d.first));
+        }
+        updateSpacer();
+    }
+}
+
+void TextDocument::updateSpacer()
+{
+    // lines above the laid out window are represented by
+    // an estimated amount of empty space at the top
+    const int hidden = d.first - d.base;
+    d.spacer = hidden > 0 ? qRound(hidden * lineHeight()) : 0;
+    const qreal margin = documentMargin() + d.spacer;
+    QTextFrameFormat format = rootFrame()->frameFormat();
+    if (format.topMargin() != margin) {
+        format.setTopMargin(margin);
+        rootFrame()->setFrameFormat(format);
+    }
+}
+
+int TextDocument::pageSize() const
+{
+    // the viewport plus half a viewport of margin
+    return qMax(50, qCeil(d.viewport * 1.5 / lineHeight()));
+}
+
+qreal TextDocument::lineHeight() const
+{
+    const int count = d.last - d.first;
+    if (d.visible && count > 0) {
+        const qreal height = documentLayout()->documentSize().height() - d.spacer - 2 * documentMargin();
+        if (height > 0)
+            return height / count;
+    }
+    return QFontMetricsF(defaultFont()).lineSpacing() * 1.25;
+}
+
+QRect TextDocument::lineRect(int line) const
+{
+    if (line >= d.first && line < d.last) {
+        const QTextBlock block = findBlockByNumber(line - d.first);
+        if (block.isValid())
+            return documentLayout()->blockBoundingRect(block).toAlignedRect();
+    } else if (line >= d.base && line < d.first) {
+        const qreal height = qreal(d.spacer) / (d.first - d.base);
+        const qreal margin = documentMargin();
+        return QRectF(margin, margin + (line - d.base) * height, size().width() - 2 * margin, height).toAlignedRect();
+    }
+    return QRect();
 }
 
 void TextDocument::insert(QTextCursor& cursor, const MessageData& data)
 {
     cursor.movePosition(QTextCursor::End);
+    if (!isEmpty())
+        cursor.insertBlock();
 
+    insertLine(cursor, data);
+    resetBlock(cursor.block(), data);
+}
+
+void TextDocument::prepend(QTextCursor& cursor, const MessageData& data)
+{
+    cursor.movePosition(QTextCursor::Start);
     if (!isEmpty()) {
-        const int count = blockCount();
-        const int max = maximumBlockCount();
-        const QRectF br = documentLayout()->blockBoundingRect(findBlockByNumber(0));
         cursor.insertBlock();
+        cursor.movePosition(QTextCursor::Start);
+    }
 
-        if (count >= max) {
-            emit lineRemoved(qRound(br.bottom()));
-            shiftLights(max - count + 1);
+    insertLine(cursor, data);
+}
+
+void TextDocument::insertLine(QTextCursor& cursor, const MessageData& data)
+{
+    const TextRuns runs = data.runs();
+    if (!runs.isValid()) {
+        cursor.insertHtml(formatBlock(data.timestamp(), data.format()));
+    } else if (!data.format().isEmpty()) {
+        static const int timestamp = TextRuns::styleId("<span class='timestamp'>");
+        const QString text = runs.text();
+        bool space = true;
+        insertRun(cursor, formatTime(data.timestamp()), timestamp, QString(), space);
+        insertRun(cursor, QString(" "), 0, QString(), space);
+        for (int i = 0; i < runs.count(); ++i)
+            insertRun(cursor, text.mid(runs.position(i), runs.length(i)), runs.style(i), runs.anchor(i), space);
+    }
+}
+
+void TextDocument::insertRun(QTextCursor& cursor, const QString& text, int style, const QString& anchor, bool& space)
+{
+    QTextCharFormat format = styleFormat(style);
+    const bool pre = format.boolProperty(WhiteSpaceProperty);
+    format.clearProperty(WhiteSpaceProperty);
+
+    // white space is collapsed as it would be by the HTML importer
+    QString str;
+    str.reserve(text.length());
+    foreach (const QChar& c, text) {
+        if (pre) {
+            str += c == QLatin1Char('\n') ? QChar(QChar::LineSeparator) : c;
+            space = isCollapsible(c);
+        } else if (isCollapsible(c)) {
+            if (!space)
+                str += QLatin1Char(' ');
+            space = true;
+        } else {
+            str += c;
+            space = false;
+        }
+    }
+
+    if (!str.isEmpty()) {
+        format.setProperty(StyleProperty, style);
+        if (!anchor.isEmpty()) {
+            format.setAnchor(true);
+            format.setAnchorHref(anchor);
         }
+        cursor.insertText(str, format);
     }
+}
 
-    cursor.insertHtml(formatBlock(data.timestamp(), data.format()));
-    cursor.block().setUserData(new TextBlockMessageData(data));
+QTextCharFormat TextDocument::styleFormat(int style) const
+{
+    QHash<int, QTextCharFormat>::const_iterator it = d.styles.constFind(style);
+    if (it != d.styles.constEnd())
+        return it.value();
+    const QTextCharFormat format = resolveStyle(d.css, style);
+    d.styles.insert(style, format);
+    return format;
+}
+
+void TextDocument::resetBlock(const QTextBlock& block, const MessageData& data)
+{
+    QTextBlock(block).setUserData(new TextBlockMessageData(data));
 
+    QTextCursor cursor(block);
     QTextBlockFormat format = cursor.blockFormat();
     format.setLineHeight(125, QTextBlockFormat::ProportionalHeight);
     if (data.type() == IrcMessage::Unknown)
@@ -539,89 +909,64 @@ void TextDocument::insert(QTextCursor& cursor, const MessageData& data)
     cursor.setBlockFormat(format);
 }
 
-QString TextDocument::formatEvents(const QList<MessageData>& events) const
+QString TextDocument::formatEvents(EventAggregate* events) const
 {
     EventFormatter formatter;
     formatter.setBuffer(d.buffer);
 
+    // a netsplit may have thousands of events, only the first ones
+    // are formatted and the rest are summed up by who was involved
     QStringList lines;
-    foreach (const MessageData& event, events) {
+    const int count = qMin(events->count(), MaxTooltipEvents);
+    for (int i = 0; i < count; ++i) {
+        const MessageData event = events->event(i);
         if (!event.isEmpty()) {
-            IrcMessage* msg = IrcMessage::fromData(event.data(), d.buffer->connection());
-            lines += formatBlock(event.timestamp(), formatter.formatMessage(msg).format());
-            delete msg;
+            // parsed once, later tooltips reuse the line
+            QString detail = event.detail();
+            if (detail.isNull()) {
+                IrcMessage* msg = event.toMessage(d.buffer->connection());
+                if (msg) {
+                    detail = formatter.formatMessage(msg).format();
+                    delete msg;
+                }
+                events->setDetail(i, detail);
+            }
+            lines += formatBlock(event.timestamp(), detail);
         }
     }
+    if (count < events->count()) {
+        QSet<QString> seen;
+        QStringList nicks;
+        int i = count;
+        for (; i < events->count() && nicks.count() < MaxTooltipNicks; ++i) {
+            const QString nick = events->event(i).nick();
+            if (!seen.contains(nick)) {
+                seen.insert(nick);
+                nicks += nick;
+            }
+        }
+        if (i < events->count())
+            nicks += tr("...");
+        lines += tr("%1 more by %2").arg(events->count() - count).arg(nicks.join(tr(", ")));
+    }
     if (!lines.isEmpty())
         return tr("<html><head><style>%1</style></head><body style='white-space:pre'>%2</body></html>").arg(d.css, lines.join(tr("<br/>")));
     return QString();
 }
 
-QString TextDocument::formatSummary(const QList<MessageData>& events) const
+QString TextDocument::formatTime(const QDateTime& timestamp) const
 {
-    QStringList actions;
-    QStringList changes;
-    QSet<QString> nicks;
-    QSet<IrcMessage::Type> handled;
-    EventFormatter formatter;
+    if (!timestamp.isValid())
+        return QString();
 
-    foreach (const MessageData& event, events) {
-        switch (event.type()) {
-        case IrcMessage::Join:
-            if (!handled.contains(event.type()))
-                actions += tr("joined");
-            break;
-        case IrcMessage::Part:
-            if (!handled.contains(event.type()))
-                actions += tr("left");
-            break;
-        case IrcMessage::Quit:
-            if (event.isError()) {
-                if (!handled.contains(IrcMessage::Error))
-                    actions += tr("disconnected");
-                nicks.insert(event.nick());
-                handled.insert(IrcMessage::Error);
-                continue;
-            } else {
-                if (!handled.contains(event.type()))
-                    actions += tr("quit");
-            }
-            break;
-        case IrcMessage::Kick:
-            if (!handled.contains(event.type()))
-                actions += tr("kicked");
-            break;
-        case IrcMessage::Nick:
-            if (!handled.contains(event.type()))
-                changes += tr("nick");
-            break;
-        case IrcMessage::Mode:
-            if (!handled.contains(event.type()))
-                changes += tr("mode");
-            break;
-        case IrcMessage::Topic:
-            if (!handled.contains(event.type()))
-                changes += tr("topic");
-            break;
-        default:
-            break;
-        }
-        nicks.insert(event.nick());
-        handled.insert(event.type());
+    // consecutive lines mostly arrive within the same second, so the
+    // rendered time is reused unless the format shows milliseconds
+    const qint64 secs = timestamp.toMSecsSinceEpoch() / 1000;
+    if (secs != d.stamp || d.timeStampFormat.contains(QLatin1Char('z'))) {
+        d.stamp = secs;
+        d.stampText = timestamp.time().toString(d.timeStampFormat);
     }
-
-    if (!changes.isEmpty())
-        actions += tr("changed %1").arg(changes.join(tr(" and ")));
-
-    if (actions.count() > 2)
-        actions = QStringList() << QStringList(actions.mid(0, actions.count() - 1)).join(tr(", ")) << actions.last();
-
-    if (nicks.count() == 1)
-        return formatter.formatEvent(tr("%1 %2").arg(formatter.styledText(*nicks.begin(), MessageFormatter::Bold),
-                                                     actions.join(tr(" and "))));
-
-    return formatter.formatEvent(tr("%1 %2").arg(formatter.styledText(tr("%1 users").arg(nicks.count()), MessageFormatter::Bold),
-                                                 actions.join(tr(" or "))));
+    return d.stampText;
 }
 
 QString TextDocument::formatBlock(const QDateTime& timestamp, const QString& message) const
@@ -629,7 +974,7 @@ QString TextDocument::formatBlock(const QDateTime& timestamp, const QString& mes
     if (message.isEmpty())
         return QString();
 
-    const QString time = timestamp.time().toString(d.timeStampFormat);
+    const QString time = formatTime(timestamp);
     return tr("<span class='timestamp'>%1</span> %2").arg(time, message);
 }
 
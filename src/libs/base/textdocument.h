@@ -29,14 +29,18 @@
 #ifndef TEXTDOCUMENT_H
 #define TEXTDOCUMENT_H
 
+#include <QTextCharFormat>
 #include <QTextDocument>
 #include <QMetaType>
 #include <QDateTime>
+#include <QHash>
 #include "messagedata.h"
 
 class IrcBuffer;
 class IrcMessage;
 class MessageData;
+class MessageStore;
+class EventAggregate;
 class MessageFormatter;
 
 class TextDocument : public QTextDocument
@@ -56,9 +60,24 @@ public:
     bool isClone() const;
 
     IrcBuffer* buffer() const;
+    MessageStore* store() const;
     MessageFormatter* formatter() const;
 
     int totalCount() const;
+    int firstLine() const;
+    int lastLine() const;
+    int pendingCount() const;
+    bool hasPendingHighlight() const;
+
+    int viewportHeight() const;
+    void setViewportHeight(int height);
+
+    bool canFetchMore(int y) const;
+    void fetchMore();
+
+    int pageSize() const;
+    void collapse(int count);
+    bool prepare();
 
     bool isVisible() const;
     void setVisible(bool visible);
@@ -72,6 +91,7 @@ public:
     QString tooltip(const QPoint& pos) const;
 
 public slots:
+    void flush();
     void reset();
     void lowlight(int block = -1);
     void addHighlight(int block = -1);
@@ -81,35 +101,49 @@ public slots:
 
 signals:
     void lineRemoved(int height);
+    void linesPending();
     void messageReceived(IrcMessage* message);
     void messageHighlighted(IrcMessage* message);
     void privateMessageReceived(IrcMessage* message);
 
 protected:
-    void updateBlock(int number);
-    void timerEvent(QTimerEvent* event);
+    void updateLine(int line);
 
 private slots:
-    void flush();
-    void rebuild();
+    void onCleared();
+    void onLineAppended(int dropped);
+    void onLinesPrepended(int count);
+    void onLineMerged();
+    void onBatchFinished();
+    void onMessageReceived(IrcMessage* message, const MessageData& data);
 
 private:
-    void scheduleRebuild();
+    void restyle(const QString& css, const QString& timeStampFormat);
     void shiftLights(int diff);
+    void trim(int count);
+    void updateSpacer();
+    qreal lineHeight() const;
+    QRect lineRect(int line) const;
     void insert(QTextCursor& cursor, const MessageData& data);
-
-    QString formatEvents(const QList<MessageData>& events) const;
-    QString formatSummary(const QList<MessageData>& events) const;
+    void prepend(QTextCursor& cursor, const MessageData& data);
+    void insertLine(QTextCursor& cursor, const MessageData& data);
+    void insertRun(QTextCursor& cursor, const QString& text, int style, const QString& anchor, bool& space);
+    QTextCharFormat styleFormat(int style) const;
+    void resetBlock(const QTextBlock& block, const MessageData& data);
+
+    QString formatEvents(EventAggregate* events) const;
+    QString formatTime(const QDateTime& timestamp) const;
     QString formatBlock(const QDateTime& timestamp, const QString& message) const;
 
-    friend class TextBrowser;
-
     struct Private {
         int uc;
-        int dirty;
         bool clone;
         bool batch;
-        int rebuild;
+        int base;
+        int first;
+        int last;
+        int spacer;
+        int viewport;
         QString css;
         int lowlight;
         bool visible;
@@ -117,8 +151,10 @@ private:
         QDateTime timestamp;
         QList<int> highlights;
         QString timeStampFormat;
-        QList<MessageData> queue;
-        MessageFormatter* formatter;
+        mutable qint64 stamp;
+        mutable QString stampText;
+        mutable QHash<int, QTextCharFormat> styles;
+        MessageStore* store;
     } d;
 };
 
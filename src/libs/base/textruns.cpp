@@ -0,0 +1,241 @@
+/*
+  Copyright (C) 2008-2015 The Communi Project
+
+  You may use this file under the terms of BSD license as follows:
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "textruns.h"
+#include <QStringList>
+#include <QMutex>
+#include <QHash>
+
+static QStringList styleMarkups = QStringList() << QString();
+static QHash<QString, int> styleIds;
+static QMutex styleMutex;
+
+static QString attribute(const QString& tag, const QString& name, int* from = 0, int* to = 0)
+{
+    int pos = tag.indexOf(QLatin1Char(' ') + name + QLatin1Char('='));
+    if (pos == -1)
+        return QString();
+    const int start = pos;
+    pos += name.length() + 2;
+    if (pos >= tag.length())
+        return QString();
+    const QChar quote = tag.at(pos);
+    if (quote != QLatin1Char('\'') && quote != QLatin1Char('"'))
+        return QString();
+    const int end = tag.indexOf(quote, pos + 1);
+    if (end == -1)
+        return QString();
+    if (from)
+        *from = start;
+    if (to)
+        *to = end + 1;
+    return tag.mid(pos + 1, end - pos - 1);
+}
+
+static bool decodeEntity(const QString& html, int& pos, QString& text)
+{
+    const int end = html.indexOf(QLatin1Char(';'), pos + 1);
+    if (end == -1 || end - pos > 8)
+        return false;
+    const QStringRef name = html.midRef(pos + 1, end - pos - 1);
+    if (name == QLatin1String("lt"))
+        text += QLatin1Char('<');
+    else if (name == QLatin1String("gt"))
+        text += QLatin1Char('>');
+    else if (name == QLatin1String("amp"))
+        text += QLatin1Char('&');
+    else if (name == QLatin1String("quot"))
+        text += QLatin1Char('"');
+    else if (name == QLatin1String("apos"))
+        text += QLatin1Char('\'');
+    else if (name == QLatin1String("nbsp"))
+        text += QChar(QChar::Nbsp);
+    else if (name.startsWith(QLatin1Char('#'))) {
+        bool ok = false;
+        uint code = 0;
+        if (name.length() > 1 && (name.at(1) == QLatin1Char('x') || name.at(1) == QLatin1Char('X')))
+            code = name.mid(2).toString().toUInt(&ok, 16);
+        else
+            code = name.mid(1).toString().toUInt(&ok, 10);
+        if (!ok || !code)
+            return false;
+        text += QString::fromUcs4(&code, 1);
+    } else {
+        return false;
+    }
+    pos = end + 1;
+    return true;
+}
+
+TextRuns::TextRuns()
+{
+    d.valid = false;
+}
+
+TextRuns TextRuns::fromHtml(const QString& html)
+{
+    // parses the inline markup the formatters produce into plain text
+    // and runs of styles. the styles are identified by the opening tags
+    // they consist of, so that they can be resolved against any style
+    // sheet later on. anything beyond that subset leaves the runs invalid
+    // and the line is to be inserted as HTML instead.
+    TextRuns runs;
+    QStringList tags;
+    QStringList anchors;
+    QString text;
+    int style = 0;
+    int pos = 0;
+    const int len = html.length();
+    while (pos < len) {
+        const QChar c = html.at(pos);
+        if (c == QLatin1Char('<')) {
+            const int end = html.indexOf(QLatin1Char('>'), pos + 1);
+            if (end == -1)
+                return TextRuns();
+            runs.append(text, style, anchors.isEmpty() ? QString() : anchors.last());
+            text.clear();
+            if (html.at(pos + 1) == QLatin1Char('/')) {
+                if (tags.isEmpty())
+                    return TextRuns();
+                if (tags.takeLast().startsWith(QLatin1String("<a")))
+                    anchors.removeLast();
+            } else {
+                QString tag = html.mid(pos, end - pos + 1);
+                int nameEnd = 1;
+                while (nameEnd < tag.length() && tag.at(nameEnd).isLetter())
+                    ++nameEnd;
+                const QStringRef name = tag.midRef(1, nameEnd - 1);
+                if (tag.endsWith(QLatin1String("/>")))
+                    return TextRuns();
+                if (name == QLatin1String("a")) {
+                    int from = 0, to = 0;
+                    anchors += attribute(tag, QLatin1String("href"), &from, &to);
+                    // every link shares a style, that still resolves to
+                    // the underline and the color the importer gives links
+                    if (to > from)
+                        tag.replace(from, to - from, QLatin1String(" href='x'"));
+                } else if (name != QLatin1String("span") && name != QLatin1String("b") && name != QLatin1String("i")
+                           && name != QLatin1String("u") && name != QLatin1String("s")) {
+                    return TextRuns();
+                }
+                tags += tag;
+            }
+            style = styleId(tags.join(QString()));
+            pos = end + 1;
+        } else if (c == QLatin1Char('&')) {
+            if (!decodeEntity(html, pos, text)) {
+                text += c;
+                ++pos;
+            }
+        } else {
+            text += c;
+            ++pos;
+        }
+    }
+    if (!tags.isEmpty())
+        return TextRuns();
+    runs.append(text, style, QString());
+    runs.d.valid = true;
+    return runs;
+}
+
+bool TextRuns::isValid() const
+{
+    return d.valid;
+}
+
+bool TextRuns::isEmpty() const
+{
+    return d.text.isEmpty();
+}
+
+QString TextRuns::text() const
+{
+    return d.text;
+}
+
+int TextRuns::count() const
+{
+    return d.runs.count();
+}
+
+int TextRuns::position(int run) const
+{
+    return d.runs.at(run).position;
+}
+
+int TextRuns::length(int run) const
+{
+    return d.runs.at(run).length;
+}
+
+int TextRuns::style(int run) const
+{
+    return d.runs.at(run).style;
+}
+
+QString TextRuns::anchor(int run) const
+{
+    return d.runs.at(run).anchor;
+}
+
+int TextRuns::styleId(const QString& markup)
+{
+    // lines are parsed by the formatting pipeline too
+    QMutexLocker locker(&styleMutex);
+    int id = styleIds.value(markup, -1);
+    if (id == -1) {
+        id = styleMarkups.count();
+        styleMarkups += markup;
+        styleIds.insert(markup, id);
+    }
+    return id;
+}
+
+QString TextRuns::styleMarkup(int style)
+{
+    QMutexLocker locker(&styleMutex);
+    return styleMarkups.value(style);
+}
+
+void TextRuns::append(const QString& text, int style, const QString& anchor)
+{
+    if (text.isEmpty())
+        return;
+    if (!d.runs.isEmpty() && d.runs.last().style == style && d.runs.last().anchor == anchor) {
+        d.runs.last().length += text.length();
+    } else {
+        Run run;
+        run.position = d.text.length();
+        run.length = text.length();
+        run.style = style;
+        run.anchor = anchor;
+        d.runs += run;
+    }
+    d.text += text;
+}
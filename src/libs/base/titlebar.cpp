@@ -28,6 +28,8 @@
 
 #include "titlebar.h"
 #include "messageformatter.h"
+#include "messagestore.h"
+#include "userindex.h"
 #include <QStyleOptionHeader>
 #include <QPropertyAnimation>
 #include <QStylePainter>
@@ -65,7 +67,8 @@ protected:
 TitleBar::TitleBar(QWidget* parent) : QLabel(parent)
 {
     d.buffer = 0;
-    d.model = 0;
+    d.store = 0;
+    d.index = 0;
     d.baseOffset = -1;
     d.editor = 0;
     d.formatter = new MessageFormatter(this);
@@ -92,6 +95,12 @@ TitleBar::TitleBar(QWidget* parent) : QLabel(parent)
     relayout();
 }
 
+TitleBar::~TitleBar()
+{
+    if (d.index)
+        d.index->release();
+}
+
 QMenu* TitleBar::menu() const
 {
     return d.menuButton->menu();
@@ -168,12 +177,19 @@ void TitleBar::setBuffer(IrcBuffer* buffer)
                 disconnect(channel, SIGNAL(destroyed(IrcChannel*)), this, SLOT(cleanup()));
                 disconnect(channel, SIGNAL(topicChanged(QString)), this, SLOT(refresh()));
                 disconnect(channel, SIGNAL(modeChanged(QString)), this, SLOT(refresh()));
-                if (d.model)
-                    d.model->setChannel(0);
+                if (d.index) {
+                    disconnect(d.index->model(), SIGNAL(countChanged(int)), this, SLOT(refresh()));
+                    d.index->release();
+                    d.index = 0;
+                }
             } else {
                 disconnect(d.buffer, SIGNAL(destroyed(IrcBuffer*)), this, SLOT(cleanup()));
             }
             disconnect(d.buffer, SIGNAL(titleChanged(QString)), this, SLOT(refresh()));
+            if (d.store) {
+                disconnect(d.store, SIGNAL(firehoseChanged(bool)), this, SLOT(refresh()));
+                d.store = 0;
+            }
         }
         d.buffer = buffer;
         if (d.buffer) {
@@ -182,15 +198,14 @@ void TitleBar::setBuffer(IrcBuffer* buffer)
                 connect(channel, SIGNAL(destroyed(IrcChannel*)), this, SLOT(cleanup()));
                 connect(channel, SIGNAL(topicChanged(QString)), this, SLOT(refresh()));
                 connect(channel, SIGNAL(modeChanged(QString)), this, SLOT(refresh()));
-                if (!d.model) {
-                    d.model = new IrcUserModel(this);
-                    connect(d.model, SIGNAL(countChanged(int)), this, SLOT(refresh()));
-                }
-                d.model->setChannel(channel);
+                d.index = UserIndex::acquire(channel);
+                connect(d.index->model(), SIGNAL(countChanged(int)), this, SLOT(refresh()));
             } else {
                 connect(d.buffer, SIGNAL(destroyed(IrcBuffer*)), this, SLOT(cleanup()));
             }
             connect(d.buffer, SIGNAL(titleChanged(QString)), this, SLOT(refresh()));
+            d.store = MessageStore::instance(d.buffer);
+            connect(d.store, SIGNAL(firehoseChanged(bool)), this, SLOT(refresh()));
         }
         collapse();
         refresh();
@@ -304,7 +319,12 @@ void TitleBar::relayout()
 
 void TitleBar::cleanup()
 {
+    if (d.index) {
+        d.index->release();
+        d.index = 0;
+    }
     d.buffer = 0;
+    d.store = 0;
     refresh();
 }
 
@@ -319,8 +339,10 @@ void TitleBar::refresh()
     QStringList info;
 //    if (channel && !channel->mode().isEmpty())
 //        info += channel->mode();
-    if (d.model && d.model->count() > 0)
-        info += QString::number(d.model->count());
+    if (d.index && d.index->model()->count() > 0)
+        info += QString::number(d.index->model()->count());
+    if (d.store && d.store->isFirehose())
+        info += tr("firehose");
 
     if (info.isEmpty() && topic.isEmpty())
         setText(title);
@@ -34,7 +34,8 @@
 #include <QToolButton>
 
 class IrcBuffer;
-class IrcUserModel;
+class UserIndex;
+class MessageStore;
 class MessageFormatter;
 
 class TitleBar : public QLabel
@@ -44,6 +45,7 @@ class TitleBar : public QLabel
 
 public:
     explicit TitleBar(QWidget* parent = 0);
+    ~TitleBar();
 
     IrcBuffer* buffer() const;
     QString topic() const;
@@ -91,10 +93,11 @@ private:
         QString css;
         int baseOffset;
         IrcBuffer* buffer;
+        MessageStore* store;
         QTextEdit* editor;
         QToolButton* menuButton;
         MessageFormatter* formatter;
-        IrcUserModel* model;
+        UserIndex* index;
     } d;
 };
 
@@ -0,0 +1,143 @@
+/*
+  Copyright (C) 2008-2015 The Communi Project
+
+  You may use this file under the terms of BSD license as follows:
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "userindex.h"
+#include <IrcUserModel>
+#include <IrcChannel>
+#include <IrcUser>
+#include <Irc>
+
+static QHash<IrcChannel*, UserIndex*> indexes;
+
+UserIndex::UserIndex(IrcChannel* channel) : QObject(0)
+{
+    d.ref = 0;
+    d.channel = channel;
+
+    // sorted once for the list views, everybody else shares the order
+    d.model = new IrcUserModel(this);
+    d.model->setSortMethod(Irc::SortByTitle);
+    d.model->setChannel(channel);
+
+    connect(d.model, SIGNAL(modelReset()), this, SLOT(reindex()));
+    connect(d.model, SIGNAL(added(IrcUser*)), this, SLOT(onUserAdded(IrcUser*)));
+    connect(d.model, SIGNAL(removed(IrcUser*)), this, SLOT(onUserRemoved(IrcUser*)));
+    connect(channel, SIGNAL(destroyed(IrcChannel*)), this, SLOT(onChannelDestroyed()));
+
+    reindex();
+}
+
+UserIndex::~UserIndex()
+{
+    if (d.channel)
+        indexes.remove(d.channel);
+}
+
+UserIndex* UserIndex::acquire(IrcChannel* channel)
+{
+    if (!channel)
+        return 0;
+
+    UserIndex* index = indexes.value(channel);
+    if (!index) {
+        index = new UserIndex(channel);
+        indexes.insert(channel, index);
+    }
+    ++index->d.ref;
+    return index;
+}
+
+void UserIndex::release()
+{
+    if (--d.ref <= 0)
+        delete this;
+}
+
+IrcChannel* UserIndex::channel() const
+{
+    return d.channel;
+}
+
+IrcUserModel* UserIndex::model() const
+{
+    return d.model;
+}
+
+const NickMatcher& UserIndex::names() const
+{
+    return d.names;
+}
+
+void UserIndex::reindex()
+{
+    // the name index is updated user by user, and the matcher is only
+    // compiled again once the next message needs it. that way a whole
+    // netjoin or netsplit burst ends up costing a single rebuild.
+    foreach (IrcUser* user, d.users.keys())
+        disconnect(user, SIGNAL(nameChanged(QString)), this, SLOT(onUserRenamed(QString)));
+    d.users.clear();
+    d.names.clear();
+    foreach (IrcUser* user, d.model->users())
+        onUserAdded(user);
+}
+
+void UserIndex::onUserAdded(IrcUser* user)
+{
+    if (!d.users.contains(user)) {
+        d.users.insert(user, user->name());
+        d.names.addName(user->name());
+        connect(user, SIGNAL(nameChanged(QString)), this, SLOT(onUserRenamed(QString)));
+    }
+}
+
+void UserIndex::onUserRemoved(IrcUser* user)
+{
+    if (d.users.contains(user)) {
+        d.names.removeName(d.users.take(user));
+        disconnect(user, SIGNAL(nameChanged(QString)), this, SLOT(onUserRenamed(QString)));
+    }
+}
+
+void UserIndex::onUserRenamed(const QString& name)
+{
+    IrcUser* user = static_cast<IrcUser*>(sender());
+    if (d.users.contains(user)) {
+        d.names.removeName(d.users.value(user));
+        d.names.addName(name);
+        d.users.insert(user, name);
+    }
+}
+
+void UserIndex::onChannelDestroyed()
+{
+    // whoever still holds on to the index gets an empty one
+    indexes.remove(d.channel);
+    d.channel = 0;
+    d.users.clear();
+    d.names.clear();
+}
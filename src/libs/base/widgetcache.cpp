@@ -0,0 +1,73 @@
+/*
+  Copyright (C) 2008-2015 The Communi Project
+
+  You may use this file under the terms of BSD license as follows:
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "widgetcache.h"
+#include <QPainter>
+#include <QWidget>
+
+// sizes and states that can be cached per widget before starting over
+static const int MaxPixmaps = 256;
+
+qreal WidgetCache::devicePixelRatio(const QPaintDevice* device)
+{
+#if QT_VERSION >= 0x050600
+    return device->devicePixelRatioF();
+#else
+    return device->devicePixelRatio();
+#endif
+}
+
+QPixmap WidgetCache::pixmap(QWidget* widget, const QSize& size, qreal ratio, const QString& key)
+{
+    // rendering a widget runs the style sheet machinery every time,
+    // its pixmap is rendered once per size, ratio and state instead
+    const QString id = QString::number(size.width()) + QLatin1Char('x') + QString::number(size.height())
+                     + QLatin1Char('@') + QString::number(ratio) + QLatin1Char(':') + key;
+    QPixmap pixmap = d.pixmaps.value(id);
+    if (pixmap.isNull() && !size.isEmpty()) {
+        if (d.pixmaps.count() >= MaxPixmaps)
+            d.pixmaps.clear();
+
+        pixmap = QPixmap(size * ratio);
+        pixmap.setDevicePixelRatio(ratio);
+        pixmap.fill(Qt::transparent);
+
+        widget->setGeometry(QRect(QPoint(), size));
+        QPainter painter(&pixmap);
+        widget->render(&painter);
+        painter.end();
+
+        d.pixmaps.insert(id, pixmap);
+    }
+    return pixmap;
+}
+
+void WidgetCache::clear()
+{
+    d.pixmaps.clear();
+}